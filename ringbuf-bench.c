@@ -0,0 +1,375 @@
+/*
+ * ringbuf-bench.c - benchmarks for the ring buffer extensions.
+ *
+ * To the extent possible under law, the author(s) have dedicated all
+ * copyright and related and neighboring rights to this software to
+ * the public domain worldwide. This software is distributed without
+ * any warranty.
+ *
+ * You should have received a copy of the CC0 Public Domain Dedication
+ * along with this software. If not, see
+ * <http://creativecommons.org/publicdomain/zero/1.0/>.
+ */
+
+/*
+ * Usage: ringbuf-bench [steal|log|rt] [threads] [count]
+ *
+ * steal: run a fixed number of CPU-bound jobs on a work-stealing pool,
+ * with the jobs distributed over the workers uniformly and with
+ * increasingly skewed distributions, once with stealing disabled
+ * (every worker only runs its own jobs) and once with it enabled.
+ *
+ * log: measure the per-call cost of ringbufLog on the logging
+ * threads, with the background thread writing to /dev/null. By
+ * default each thread logs few enough messages to fit in its ring,
+ * so this measures the call itself, not the background thread's
+ * formatting throughput; more messages measure the latter. The
+ * fastest batch of 100 calls is reported too: with fewer CPUs than
+ * threads, the background thread's formatting runs on the logging
+ * threads' time and shows up in the average.
+ *
+ * rt: time every single call of ringbufMemcpyInto and
+ * ringbufMemcpyFrom, built with the real-time profile, on one thread
+ * (the threads argument is ignored), and report the 99.999th
+ * percentile and maximum latencies along with the median, since the
+ * worst case is what matters to a real-time thread. The default is
+ * 10^9 calls. For meaningful tails, run it on an isolated CPU with a
+ * real-time scheduling policy (e.g., chrt -f 1 taskset -c 3 ...).
+ */
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include "ringbuf.h"
+#include "ringbuf-log.h"
+#include "ringbuf-steal.h"
+
+static double
+now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * Work-stealing benchmark.
+ */
+#define STEAL_SPIN 2000
+
+struct steal_bench
+{
+    ringbuf_steal_t pool;
+    int steal;
+    unsigned long total;
+    unsigned long done;
+    unsigned long *share;       /* jobs each worker produces */
+    unsigned long sink;
+};
+
+struct steal_worker
+{
+    pthread_t thread;
+    unsigned id;
+    struct steal_bench *b;
+};
+
+static void
+steal_run_job(struct steal_bench *b, unsigned long *job)
+{
+    /* a few microseconds of arithmetic */
+    unsigned long x = *job;
+    for (int i = 0; i != STEAL_SPIN; ++i)
+        x = x * 6364136223846793005UL + 1442695040888963407UL;
+    __atomic_fetch_add(&b->sink, x, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&b->done, 1, __ATOMIC_RELEASE);
+}
+
+static void *
+steal_worker_main(void *arg)
+{
+    struct steal_worker *w = arg;
+    struct steal_bench *b = w->b;
+    unsigned long produced = 0, seed = w->id + 1;
+
+    while (__atomic_load_n(&b->done, __ATOMIC_ACQUIRE) != b->total) {
+        while (produced != b->share[w->id] &&
+               ringbufStealPush(b->pool, w->id, &seed) == 0)
+            ++produced;
+        unsigned long *job = b->steal ?
+            ringbufStealNext(b->pool, w->id) :
+            ringbufStealPop(b->pool, w->id);
+        if (job)
+            steal_run_job(b, job);
+    }
+    return 0;
+}
+
+static double
+steal_once(unsigned nworkers, unsigned long *share, unsigned long total,
+           int steal)
+{
+    struct steal_bench b;
+    struct steal_worker *workers = calloc(nworkers, sizeof(*workers));
+    memset(&b, 0, sizeof(b));
+    b.pool = ringbufStealNew(nworkers, 1024);
+    b.steal = steal;
+    b.total = total;
+    b.share = share;
+    if (!workers || !b.pool) {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+
+    double start = now();
+    for (unsigned i = 0; i != nworkers; ++i) {
+        workers[i].id = i;
+        workers[i].b = &b;
+        pthread_create(&workers[i].thread, 0, steal_worker_main, &workers[i]);
+    }
+    for (unsigned i = 0; i != nworkers; ++i)
+        pthread_join(workers[i].thread, 0);
+    double elapsed = now() - start;
+
+    ringbufStealFree(&b.pool);
+    free(workers);
+    return elapsed;
+}
+
+static void
+bench_steal(unsigned nworkers, unsigned long njobs)
+{
+    /* the fraction of all jobs that worker 0 produces */
+    static const double skews[] = {0, 0.5, 0.8, 0.95, 1.0};
+    unsigned long *share = calloc(nworkers, sizeof(unsigned long));
+
+    printf("steal: %u workers, %lu jobs\n", nworkers, njobs);
+    printf("%-10s %12s %12s %8s\n", "worker 0", "no steal", "steal", "speedup");
+    for (size_t k = 0; k != sizeof(skews) / sizeof(skews[0]); ++k) {
+        unsigned long left = njobs;
+        if (skews[k] == 0) {
+            for (unsigned i = 0; i != nworkers; ++i)
+                share[i] = njobs / nworkers + (i < njobs % nworkers);
+        } else {
+            share[0] = (unsigned long) (njobs * skews[k]);
+            left -= share[0];
+            for (unsigned i = 1; i != nworkers; ++i)
+                share[i] = left / (nworkers - 1) +
+                    (i - 1 < left % (nworkers - 1));
+        }
+        double t0 = steal_once(nworkers, share, njobs, 0);
+        double t1 = steal_once(nworkers, share, njobs, 1);
+        char label[16];
+        if (skews[k] == 0)
+            snprintf(label, sizeof(label), "uniform");
+        else
+            snprintf(label, sizeof(label), "%.0f%%", skews[k] * 100);
+        printf("%-10s %10.3f s %10.3f s %7.2fx\n", label, t0, t1, t0 / t1);
+    }
+    free(share);
+}
+
+/*
+ * Logging benchmark.
+ */
+struct log_bench
+{
+    ringbuf_log_t log;
+    int fmt;
+    unsigned long count;
+    double ns;                  /* per call, on this thread */
+    double best;                /* per call, fastest batch */
+};
+
+#define LOG_BATCH 100
+
+static void *
+log_thread_main(void *arg)
+{
+    struct log_bench *b = arg;
+    double start = now();
+    b->best = 0;
+    for (unsigned long i = 0; i != b->count; ) {
+        double t = now();
+        unsigned long end = i + LOG_BATCH < b->count ? i + LOG_BATCH : b->count;
+        unsigned long n = end - i;
+        for (; i != end; ++i)
+            ringbufLog(b->log, b->fmt, (int) i, i * 7, "request", i / 3.0);
+        t = (now() - t) * 1e9 / n;
+        if (!b->best || t < b->best)
+            b->best = t;
+    }
+    b->ns = (now() - start) * 1e9 / b->count;
+    return 0;
+}
+
+static void
+bench_log(unsigned nthreads, unsigned long count)
+{
+    int fd = open("/dev/null", O_WRONLY);
+    ringbuf_log_t log = ringbufLogNew(fd, 1 << 20, RINGBUF_LOG_BLOCK);
+    int fmt = ringbufLogFormat(log, "id=%d value=%lu name=%s ratio=%.3f\n");
+    pthread_t *threads = calloc(nthreads, sizeof(pthread_t));
+    struct log_bench *b = calloc(nthreads, sizeof(struct log_bench));
+    if (fd < 0 || !log || fmt < 0 || !threads || !b) {
+        fprintf(stderr, "log setup failed\n");
+        exit(1);
+    }
+
+    printf("log: %u threads, %lu messages each\n", nthreads, count);
+    double start = now();
+    for (unsigned i = 0; i != nthreads; ++i) {
+        b[i].log = log;
+        b[i].fmt = fmt;
+        b[i].count = count;
+        pthread_create(&threads[i], 0, log_thread_main, &b[i]);
+    }
+    for (unsigned i = 0; i != nthreads; ++i) {
+        pthread_join(threads[i], 0);
+        printf("thread %u: %.1f ns per call (fastest batch: %.1f)\n",
+               i, b[i].ns, b[i].best);
+    }
+    ringbufLogFlush(log);
+    printf("total, until written: %.1f ns per message\n",
+           (now() - start) * 1e9 / (count * nthreads));
+
+    ringbufLogFree(&log);
+    close(fd);
+    free(threads);
+    free(b);
+}
+
+/*
+ * Real-time profile latency benchmark. Latencies are kept in a
+ * histogram of 1 ns buckets; calls slower than the last bucket only
+ * count toward the maximum.
+ */
+#define RT_BUCKETS 100000
+#define RT_FRAME 48
+
+struct rt_hist
+{
+    uint64_t count;
+    uint64_t max;
+    uint64_t bucket[RT_BUCKETS];
+};
+
+static inline uint64_t
+now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static inline void
+rt_record(struct rt_hist *h, uint64_t ns)
+{
+    ++h->count;
+    if (ns > h->max)
+        h->max = ns;
+    ++h->bucket[ns < RT_BUCKETS ? ns : RT_BUCKETS - 1];
+}
+
+/* the smallest latency that at least fraction p of the calls beat */
+static uint64_t
+rt_percentile(const struct rt_hist *h, double p)
+{
+    uint64_t want = (uint64_t) (h->count * p), seen = 0;
+    for (uint64_t ns = 0; ns != RT_BUCKETS; ++ns) {
+        seen += h->bucket[ns];
+        if (seen > want)
+            return ns == RT_BUCKETS - 1 ? h->max : ns;
+    }
+    return h->max;
+}
+
+static void
+rt_report(const char *name, const struct rt_hist *h)
+{
+    printf("%-18s %12llu %8llu %8llu %8llu %8llu\n", name,
+           (unsigned long long) h->count,
+           (unsigned long long) rt_percentile(h, 0.5),
+           (unsigned long long) rt_percentile(h, 0.99),
+           (unsigned long long) rt_percentile(h, 0.99999),
+           (unsigned long long) h->max);
+}
+
+static void
+bench_rt(unsigned long long count)
+{
+    struct rt_hist *timer = calloc(1, sizeof(struct rt_hist));
+    struct rt_hist *into = calloc(1, sizeof(struct rt_hist));
+    struct rt_hist *from = calloc(1, sizeof(struct rt_hist));
+    /* a buffer size that frames don't divide, so copies wrap at
+     * every offset */
+    ringbuf_t rb = ringbufNew(1000);
+    uint8_t frame[RT_FRAME] = {0};
+    if (!timer || !into || !from || !rb) {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+    /* no page faults in the timed loop */
+    if (mlockall(MCL_CURRENT | MCL_FUTURE) != 0)
+        fprintf(stderr, "mlockall failed; page faults may show up\n");
+
+    /* keep the ring half full, so neither call ever fails */
+    for (int i = 0; i != 10; ++i)
+        ringbufMemcpyInto(rb, frame, RT_FRAME);
+
+    for (unsigned long long i = 0; i != count / 100 + 1; ++i) {
+        uint64_t t0 = now_ns();
+        uint64_t t1 = now_ns();
+        rt_record(timer, t1 - t0);
+    }
+    for (unsigned long long i = 0; i < count; i += 2) {
+        uint64_t t0 = now_ns();
+        ringbufMemcpyInto(rb, frame, RT_FRAME);
+        uint64_t t1 = now_ns();
+        ringbufMemcpyFrom(frame, rb, RT_FRAME);
+        uint64_t t2 = now_ns();
+        rt_record(into, t1 - t0);
+        rt_record(from, t2 - t1);
+    }
+
+    printf("rt: %llu calls, %d-byte frames, latencies in ns "
+           "(timer overhead included)\n", count, RT_FRAME);
+    printf("%-18s %12s %8s %8s %8s %8s\n", "", "calls", "p50", "p99",
+           "p99.999", "max");
+    rt_report("timer alone", timer);
+    rt_report("ringbufMemcpyInto", into);
+    rt_report("ringbufMemcpyFrom", from);
+
+    ringbufFree(&rb);
+    free(timer);
+    free(into);
+    free(from);
+}
+
+int
+main(int argc, char **argv)
+{
+    const char *which = argc > 1 ? argv[1] : "steal";
+    unsigned nworkers = argc > 2 ? atoi(argv[2]) : 4;
+
+    if (strcmp(which, "steal") == 0) {
+        if (nworkers < 2)
+            nworkers = 2;
+        bench_steal(nworkers, argc > 3 ? strtoul(argv[3], 0, 10) : 200000);
+    } else if (strcmp(which, "log") == 0) {
+        bench_log(argc > 2 ? nworkers : 1,
+                  argc > 3 ? strtoul(argv[3], 0, 10) : 20000);
+    } else if (strcmp(which, "rt") == 0) {
+        bench_rt(argc > 3 ? strtoull(argv[3], 0, 10) : 1000000000ULL);
+    } else {
+        fprintf(stderr, "usage: %s [steal|log|rt] [threads] [count]\n",
+                argv[0]);
+        return 1;
+    }
+    return 0;
+}
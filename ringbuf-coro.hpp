@@ -0,0 +1,289 @@
+#ifndef INCLUDED_RINGBUF_CORO_HPP
+#define INCLUDED_RINGBUF_CORO_HPP
+
+/*
+ * ringbuf-coro.hpp - C++20 coroutine support for ring buffers.
+ *
+ * To the extent possible under law, the author(s) have dedicated all
+ * copyright and related and neighboring rights to this software to
+ * the public domain worldwide. This software is distributed without
+ * any warranty.
+ *
+ * You should have received a copy of the CC0 Public Domain Dedication
+ * along with this software. If not, see
+ * <http://creativecommons.org/publicdomain/zero/1.0/>.
+ */
+
+/*
+ * An async_ringbuf wraps a ringbuf; its consumer can co_await
+ * readable(n) and its producer writable(n) instead of polling: the
+ * awaiting coroutine is suspended until the other side commits or
+ * consumes enough bytes, and is then handed to an executor to be
+ * resumed. Executors are pluggable; event_loop is a minimal
+ * single-threaded one.
+ *
+ * The ringbuf is a private member rather than a base class, so there
+ * is no way to reach its write(), read(), commit(), consume() or
+ * clear() that bypasses the wakeups. There is at most one waiting
+ * reader and one waiting writer per ring buffer. Changes made
+ * through the C interface (via get()) don't wake anybody.
+ *
+ * A suspended coroutine may be destroyed: it stops waiting, and if
+ * it was already handed to the executor, the executor forgets it.
+ * The async_ringbuf must outlive the coroutines waiting on it. Like
+ * the C ring buffer, an async_ringbuf is not thread-safe: the
+ * producer, the consumer and the executor must all run on the same
+ * thread.
+ */
+
+#include <array>
+#include <coroutine>
+#include <cstddef>
+#include <deque>
+#include <span>
+#include <utility>
+
+#include "ringbuf.hpp"
+
+namespace cringbuf {
+
+/*
+ * Something that resumes coroutines, later and from a clean stack,
+ * so that a producer's commit never runs the consumer's code
+ * re-entrantly.
+ */
+class executor
+{
+public:
+    virtual ~executor() = default;
+    virtual void post(std::coroutine_handle<> h) = 0;
+
+    /*
+     * Drop h, posted but not yet resumed, because its coroutine is
+     * being destroyed.
+     */
+    virtual void cancel(std::coroutine_handle<> h) = 0;
+};
+
+/*
+ * A single-threaded executor: post() queues, run() resumes queued
+ * coroutines in FIFO order until there are none left.
+ */
+class event_loop : public executor
+{
+public:
+    void post(std::coroutine_handle<> h) override { ready_.push_back(h); }
+    void cancel(std::coroutine_handle<> h) override { std::erase(ready_, h); }
+
+    /*
+     * Resume one queued coroutine. Returns false if there was none.
+     */
+    bool run_one()
+    {
+        if (ready_.empty())
+            return false;
+        std::coroutine_handle<> h = ready_.front();
+        ready_.pop_front();
+        h.resume();
+        return true;
+    }
+
+    /*
+     * Run until no coroutine is ready. Returns the number resumed.
+     */
+    std::size_t run()
+    {
+        std::size_t n = 0;
+        while (run_one())
+            ++n;
+        return n;
+    }
+
+private:
+    std::deque<std::coroutine_handle<>> ready_;
+};
+
+class async_ringbuf
+{
+public:
+    async_ringbuf(std::size_t capacity, executor &ex)
+        : ring_(capacity), ex_(&ex)
+    {
+    }
+
+    /* waiting coroutines refer to the ring buffer by address */
+    async_ringbuf(async_ringbuf &&) = delete;
+    async_ringbuf &operator=(async_ringbuf &&) = delete;
+
+    /*
+     * Awaitables. n is clamped to the ring buffer's capacity, since
+     * no more than that can ever be readable or writable at once.
+     */
+    class readable_awaiter
+    {
+    public:
+        bool await_ready() const noexcept { return rb_.size() >= n_; }
+        void await_suspend(std::coroutine_handle<> h) noexcept
+        {
+            h_ = h;
+            rb_.reader_ = {h, n_};
+        }
+        void await_resume() noexcept { h_ = nullptr; }
+
+        /* destroyed while suspended: the coroutine is going away */
+        ~readable_awaiter()
+        {
+            if (h_)
+                rb_.forget(rb_.reader_, h_);
+        }
+
+    private:
+        friend class async_ringbuf;
+        readable_awaiter(async_ringbuf &rb, std::size_t n) : rb_(rb), n_(n) {}
+        async_ringbuf &rb_;
+        std::size_t n_;
+        std::coroutine_handle<> h_ = nullptr;
+    };
+
+    class writable_awaiter
+    {
+    public:
+        bool await_ready() const noexcept { return rb_.available() >= n_; }
+        void await_suspend(std::coroutine_handle<> h) noexcept
+        {
+            h_ = h;
+            rb_.writer_ = {h, n_};
+        }
+        void await_resume() noexcept { h_ = nullptr; }
+
+        ~writable_awaiter()
+        {
+            if (h_)
+                rb_.forget(rb_.writer_, h_);
+        }
+
+    private:
+        friend class async_ringbuf;
+        writable_awaiter(async_ringbuf &rb, std::size_t n) : rb_(rb), n_(n) {}
+        async_ringbuf &rb_;
+        std::size_t n_;
+        std::coroutine_handle<> h_ = nullptr;
+    };
+
+    /*
+     * co_await readable(n) completes once at least n bytes are used.
+     */
+    readable_awaiter readable(std::size_t n) noexcept
+    {
+        return {*this, std::min(n, capacity())};
+    }
+
+    /*
+     * co_await writable(n) completes once at least n bytes are free.
+     */
+    writable_awaiter writable(std::size_t n) noexcept
+    {
+        return {*this, std::min(n, capacity())};
+    }
+
+    /*
+     * The ringbuf interface, waking the waiting reader or writer when
+     * it adds or removes bytes.
+     */
+    ringbuf_t get() const noexcept { return ring_.get(); }
+    std::size_t capacity() const noexcept { return ring_.capacity(); }
+    std::size_t size() const noexcept { return ring_.size(); }
+    std::size_t available() const noexcept { return ring_.available(); }
+    bool empty() const noexcept { return ring_.empty(); }
+    bool full() const noexcept { return ring_.full(); }
+
+    void clear()
+    {
+        ring_.clear();
+        wake_writer();
+    }
+
+    std::size_t write(std::span<const std::byte> src)
+    {
+        std::size_t n = ring_.write(src);
+        wake_reader();
+        return n;
+    }
+
+    std::size_t read(std::span<std::byte> dst)
+    {
+        std::size_t n = ring_.read(dst);
+        wake_writer();
+        return n;
+    }
+
+    std::array<std::span<const std::byte>, 2> readable_segments() const noexcept
+    {
+        return ring_.readable_segments();
+    }
+
+    byte_iterator begin() const noexcept { return ring_.begin(); }
+    byte_iterator end() const noexcept { return ring_.end(); }
+
+    template <typename F>
+    bool for_each_segment(F &&f) const
+    {
+        return ring_.for_each_segment(std::forward<F>(f));
+    }
+
+    std::array<std::span<std::byte>, 2> writable_segments() noexcept
+    {
+        return ring_.writable_segments();
+    }
+
+    void commit(std::size_t n)
+    {
+        ring_.commit(n);
+        wake_reader();
+    }
+
+    void consume(std::size_t n)
+    {
+        ring_.consume(n);
+        wake_writer();
+    }
+
+private:
+    struct waiter
+    {
+        std::coroutine_handle<> h;
+        std::size_t n;
+    };
+
+    /*
+     * Stop waking h: it's still waiting in w, or already posted.
+     */
+    void forget(waiter &w, std::coroutine_handle<> h)
+    {
+        if (w.h == h)
+            w = {};
+        else
+            ex_->cancel(h);
+    }
+
+    void wake_reader()
+    {
+        if (reader_.h && size() >= reader_.n)
+            ex_->post(std::exchange(reader_.h, nullptr));
+    }
+
+    void wake_writer()
+    {
+        if (writer_.h && available() >= writer_.n)
+            ex_->post(std::exchange(writer_.h, nullptr));
+    }
+
+    ringbuf ring_;
+    executor *ex_;
+    waiter reader_ = {};
+    waiter writer_ = {};
+};
+
+} // namespace cringbuf
+
+#endif /* INCLUDED_RINGBUF_CORO_HPP */
@@ -0,0 +1,357 @@
+/*
+ * ringbuf-cxx-test.cc - unit tests for the C++ ring buffer interface.
+ *
+ * To the extent possible under law, the author(s) have dedicated all
+ * copyright and related and neighboring rights to this software to
+ * the public domain worldwide. This software is distributed without
+ * any warranty.
+ *
+ * You should have received a copy of the CC0 Public Domain Dedication
+ * along with this software. If not, see
+ * <http://creativecommons.org/publicdomain/zero/1.0/>.
+ */
+
+#undef NDEBUG
+#include <cassert>
+#include <cstdio>
+#include <cstring>
+#include <exception>
+#include <algorithm>
+#include <cstdint>
+#include <iterator>
+#include <new>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+#include "ringbuf.hpp"
+#include "ringbuf-coro.hpp"
+
+using cringbuf::ringbuf;
+using cringbuf::async_ringbuf;
+using cringbuf::event_loop;
+
+/*
+ * A minimal eagerly-started, self-destroying coroutine type for
+ * driving the awaitables.
+ */
+struct detached
+{
+    struct promise_type
+    {
+        detached get_return_object() { return {}; }
+        std::suspend_never initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception() { std::terminate(); }
+    };
+};
+
+static detached
+producer(async_ringbuf &rb, const char *msg, int *steps)
+{
+    std::size_t len = std::strlen(msg);
+    for (std::size_t i = 0; i < len; i += 4) {
+        std::size_t n = std::min<std::size_t>(4, len - i);
+        co_await rb.writable(n);
+        assert(rb.write(std::as_bytes(std::span(msg + i, n))) == n);
+        ++*steps;
+    }
+}
+
+static detached
+consumer(async_ringbuf &rb, char *out, std::size_t len, int *steps)
+{
+    for (std::size_t i = 0; i < len; i += 6) {
+        std::size_t n = std::min<std::size_t>(6, len - i);
+        co_await rb.readable(n);
+        assert(rb.read(std::as_writable_bytes(std::span(out + i, n))) == n);
+        ++*steps;
+    }
+}
+
+/*
+ * A coroutine whose frame outlives it, so it can be destroyed while
+ * suspended.
+ */
+struct owned
+{
+    struct promise_type
+    {
+        owned get_return_object()
+        {
+            return {std::coroutine_handle<promise_type>::from_promise(*this)};
+        }
+        std::suspend_never initial_suspend() noexcept { return {}; }
+        std::suspend_always final_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception() { std::terminate(); }
+    };
+    std::coroutine_handle<> h;
+};
+
+static owned
+owned_consumer(async_ringbuf &rb, char *out, int *steps)
+{
+    co_await rb.readable(4);
+    rb.read(std::as_writable_bytes(std::span(out, 4)));
+    ++*steps;
+}
+
+#define START_NEW_TEST(test_num) \
+    fprintf(stderr, "C++ test %d...", (++test_num));
+
+#define END_TEST(test_num) \
+    fprintf(stderr, "pass.\n");
+
+static std::span<const std::byte>
+bytes(const char *s)
+{
+    return std::as_bytes(std::span<const char>(s, std::strlen(s)));
+}
+
+int
+main()
+{
+    int test_num = 0;
+
+    static_assert(std::random_access_iterator<cringbuf::byte_iterator>);
+    static_assert(!std::is_copy_constructible_v<ringbuf>);
+    static_assert(std::is_nothrow_move_constructible_v<ringbuf>);
+
+    /* Initial conditions */
+    START_NEW_TEST(test_num);
+    {
+        ringbuf rb(15);
+        assert(rb.capacity() == 15);
+        assert(rb.size() == 0);
+        assert(rb.available() == 15);
+        assert(rb.empty() && !rb.full());
+        assert(rb.readable_segments()[0].empty());
+        assert(rb.writable_segments()[0].size() == 15);
+    }
+    END_TEST(test_num);
+
+    /* write never overflows; read drains in FIFO order */
+    START_NEW_TEST(test_num);
+    {
+        ringbuf rb(15);
+        std::byte out[32];
+        assert(rb.write(bytes("0123456789")) == 10);
+        assert(rb.write(bytes("abcdefghij")) == 5);
+        assert(rb.full());
+        assert(rb.read(std::span(out, 8)) == 8);
+        assert(std::memcmp(out, "01234567", 8) == 0);
+        /* free space and then data wrap */
+        assert(rb.write(bytes("ABCDEFGH")) == 8);
+        auto rd = rb.readable_segments();
+        assert(rd[0].size() == 8 && rd[1].size() == 7);
+        assert(std::memcmp(rd[1].data(), "BCDEFGH", 7) == 0);
+        assert(rb.read(out) == 15);
+        assert(std::memcmp(out, "89abcdeABCDEFGH", 15) == 0);
+        assert(rb.empty());
+        /* bytes in flight are only released by an acknowledgement */
+        assert(rb.write(bytes("sent")) == 4);
+        ringbufMarkSent(rb.get(), 2);
+        assert(rb.read(out) == 0 && rb.size() == 4);
+        assert(ringbufAck(rb.get(), 2) == 2);
+        assert(rb.read(out) == 2);
+        assert(std::memcmp(out, "nt", 2) == 0);
+    }
+    END_TEST(test_num);
+
+    /* in-place writes through writable_segments */
+    START_NEW_TEST(test_num);
+    {
+        ringbuf rb(15);
+        std::byte out[16];
+        assert(rb.write(bytes("0123456789")) == 10);
+        rb.consume(10);
+        auto wr = rb.writable_segments();
+        assert(wr[0].size() == 6 && wr[1].size() == 9);
+        std::memcpy(wr[0].data(), "wrap", 4);
+        rb.commit(4);
+        assert(rb.size() == 4);
+        assert(rb.read(out) == 4);
+        assert(std::memcmp(out, "wrap", 4) == 0);
+    }
+    END_TEST(test_num);
+
+    /* moves transfer ownership; the moved-from object owns nothing */
+    START_NEW_TEST(test_num);
+    {
+        ringbuf a(15);
+        assert(a.write(bytes("moved")) == 5);
+        ringbuf_t c = a.get();
+        ringbuf b(std::move(a));
+        assert(a.get() == nullptr);
+        assert(b.get() == c && b.size() == 5);
+        ringbuf d(7);
+        d = std::move(b);
+        assert(d.get() == c && b.get() == nullptr);
+        ringbuf_t raw = d.release();
+        assert(raw == c && d.get() == nullptr);
+        ringbuf e(raw);
+        assert(e.size() == 5);
+    }
+    END_TEST(test_num);
+
+    /* iterators hide the wrap from standard algorithms */
+    START_NEW_TEST(test_num);
+    {
+        ringbuf rb(15);
+        assert(rb.begin() == rb.end());
+        assert(rb.write(bytes("0123456789")) == 10);
+        rb.consume(10);
+        assert(rb.write(bytes("needle in hay")) == 13);
+        assert(rb.readable_segments()[1].size() == 7);
+        assert(rb.end() - rb.begin() == 13);
+        auto n = bytes("in hay");
+        auto it = std::search(rb.begin(), rb.end(), n.begin(), n.end());
+        assert(it.offset() == 7);
+        assert(it[0] == std::byte('i') && *(it + 5) == std::byte('y'));
+        it = std::find(rb.begin(), rb.end(), std::byte(' '));
+        assert(it.offset() == 6);
+        assert(std::equal(rb.begin(), rb.end(), bytes("needle in hay").begin()));
+        std::reverse_iterator<cringbuf::byte_iterator> r(rb.end());
+        assert(*r == std::byte('y'));
+        assert(std::distance(rb.begin(), std::find(rb.begin(), rb.end(),
+                                                   std::byte('z'))) == 13);
+    }
+    END_TEST(test_num);
+
+    /* segmented iteration visits each contiguous run once */
+    START_NEW_TEST(test_num);
+    {
+        ringbuf rb(15);
+        assert(rb.write(bytes("0123456789")) == 10);
+        rb.consume(10);
+        assert(rb.write(bytes("hash me, please")) == 15);
+        std::uint32_t h1 = 2166136261u, h2 = 2166136261u;
+        int nsegs = 0;
+        rb.for_each_segment([&](std::span<const std::byte> seg) {
+            ++nsegs;
+            for (std::byte b : seg)
+                h1 = (h1 ^ std::to_integer<std::uint32_t>(b)) * 16777619u;
+        });
+        for (std::byte b : rb)
+            h2 = (h2 ^ std::to_integer<std::uint32_t>(b)) * 16777619u;
+        assert(nsegs == 2 && h1 == h2);
+        nsegs = 0;
+        assert(!rb.for_each_segment([&](std::span<const std::byte>) {
+            ++nsegs;
+            return false;
+        }));
+        assert(nsegs == 1);
+    }
+    END_TEST(test_num);
+
+    /* readable() suspends until the producer commits enough */
+    START_NEW_TEST(test_num);
+    {
+        event_loop loop;
+        async_ringbuf rb(7, loop);
+        char out[8] = {0};
+        int csteps = 0;
+        consumer(rb, out, 6, &csteps);
+        assert(csteps == 0);
+        assert(rb.write(bytes("abc")) == 3);
+        assert(loop.run() == 0);
+        assert(csteps == 0);
+        assert(rb.write(bytes("def")) == 3);
+        assert(csteps == 0);
+        assert(loop.run() == 1);
+        assert(csteps == 1);
+        assert(std::memcmp(out, "abcdef", 6) == 0);
+    }
+    END_TEST(test_num);
+
+    /* producer and consumer ping-pong through a small ring */
+    START_NEW_TEST(test_num);
+    {
+        event_loop loop;
+        /* must hold a consumer's chunk plus a partial producer chunk */
+        async_ringbuf rb(9, loop);
+        const char *msg = "the quick brown fox jumps over the lazy dog";
+        std::size_t len = std::strlen(msg);
+        char out[64] = {0};
+        int psteps = 0, csteps = 0;
+        consumer(rb, out, len, &csteps);
+        producer(rb, msg, &psteps);
+        loop.run();
+        assert(psteps == 11 && csteps == 8);
+        assert(std::memcmp(out, msg, len) == 0);
+        assert(rb.empty());
+    }
+    END_TEST(test_num);
+
+    /* a coroutine destroyed while suspended is never resumed */
+    START_NEW_TEST(test_num);
+    {
+        event_loop loop;
+        async_ringbuf rb(8, loop);
+        char out[8];
+        int steps = 0;
+        std::coroutine_handle<> h = owned_consumer(rb, out, &steps).h;
+        h.destroy();
+        assert(rb.write(bytes("abcd")) == 4);
+        assert(loop.run() == 0 && steps == 0);
+        rb.clear();
+        /* woken, but destroyed before the loop got to it */
+        h = owned_consumer(rb, out, &steps).h;
+        assert(rb.write(bytes("abcd")) == 4);
+        h.destroy();
+        assert(loop.run() == 0 && steps == 0);
+    }
+    END_TEST(test_num);
+
+    /* every way of freeing space wakes the writer, clear() included */
+    START_NEW_TEST(test_num);
+    {
+        static_assert(!std::is_convertible_v<async_ringbuf &, ringbuf &>);
+        event_loop loop;
+        async_ringbuf rb(6, loop);
+        int psteps = 0;
+        assert(rb.write(bytes("xxxxx")) == 5);
+        producer(rb, "abcd", &psteps);
+        assert(loop.run() == 0 && psteps == 0);
+        rb.clear();
+        assert(loop.run() == 1 && psteps == 1);
+        char out[4];
+        assert(rb.read(std::as_writable_bytes(std::span(out))) == 4);
+        assert(std::memcmp(out, "abcd", 4) == 0);
+    }
+    END_TEST(test_num);
+
+    /* pmr containers allocating from a FIFO arena */
+    START_NEW_TEST(test_num);
+    {
+        cringbuf::arena_resource arena(4096);
+        {
+            std::pmr::vector<std::pmr::string> msgs(&arena);
+            for (int i = 0; i != 20; ++i)
+                msgs.emplace_back(std::string(40, 'a' + i));
+            /* the vector's old buffers were released out of order */
+            assert(arena.live() == 21);
+            for (int i = 0; i != 20; ++i)
+                assert(std::string_view(msgs[i]) == std::string(40, 'a' + i));
+        }
+        assert(arena.live() == 0 && arena.bytes_used() == 0);
+
+        std::pmr::polymorphic_allocator<std::uint64_t> alloc(&arena);
+        std::uint64_t *big = alloc.allocate(400);
+        assert(reinterpret_cast<std::uintptr_t>(big) % alignof(std::uint64_t) == 0);
+        bool threw = false;
+        try {
+            (void) alloc.allocate(200);
+        } catch (const std::bad_alloc &) {
+            threw = true;
+        }
+        assert(threw);
+        alloc.deallocate(big, 400);
+        assert(arena.bytes_used() == 0);
+    }
+    END_TEST(test_num);
+
+    return 0;
+}
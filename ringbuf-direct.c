@@ -0,0 +1,245 @@
+/*
+ * ringbuf-direct.c - background draining of a ring to a file in
+ * whole, aligned blocks, for O_DIRECT.
+ *
+ * To the extent possible under law, the author(s) have dedicated all
+ * copyright and related and neighboring rights to this software to
+ * the public domain worldwide. This software is distributed without
+ * any warranty.
+ *
+ * You should have received a copy of the CC0 Public Domain Dedication
+ * along with this software. If not, see
+ * <http://creativecommons.org/publicdomain/zero/1.0/>.
+ */
+
+#include "ringbuf-direct.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifndef RINGBUF_NO_ASSERT
+#include <assert.h>
+#endif /* !RINGBUF_NO_ASSERT */
+
+#define RINGBUF_DIRECT_LINE 64
+
+/*
+ * head and tail are ever-increasing byte positions, masked to find
+ * the offset in buf; a position's file offset is offset plus the
+ * position. The producer moves head. The background thread moves
+ * tail, one whole block at a time, so tail is always block-aligned
+ * and the partial block (if any) lies between tail and head.
+ *
+ * A flush publishes the head it wants written in flush_req, and the
+ * background thread moves flushed up to it when it's done.
+ */
+struct ringbuf_direct_s
+{
+    uint64_t head;
+    char pad0[RINGBUF_DIRECT_LINE - sizeof(uint64_t)];
+    uint64_t tail;
+    uint64_t flushed;
+    char pad1[RINGBUF_DIRECT_LINE - 2 * sizeof(uint64_t)];
+    uint64_t flush_req;
+    int error;                  /* errno of the first failed write */
+    int stop;
+    int fd;
+    off_t offset;
+    uint64_t size;
+    uint64_t block;
+    uint8_t *buf;
+    pthread_t thread;
+};
+
+static void *ringbufDirectMain(void *arg);
+
+ringbuf_direct_t ringbufDirectNew(int fd, off_t offset, size_t size,
+                                  size_t block)
+{
+    if (block == 0)
+        block = RINGBUF_DIRECT_BLOCK;
+    if ((block & (block - 1)) || block < sizeof(void *) ||
+        offset < 0 || (offset & (block - 1))) {
+        errno = EINVAL;
+        return 0;
+    }
+    uint64_t sz = 2 * block;
+    while (sz < size)
+        sz <<= 1;
+
+    ringbuf_direct_t d = calloc(1, sizeof(struct ringbuf_direct_s));
+    if (!d)
+        return 0;
+    d->fd = fd;
+    d->offset = offset;
+    d->size = sz;
+    d->block = block;
+    int r = posix_memalign((void **) &d->buf, block, sz);
+    if (r == 0)
+        r = pthread_create(&d->thread, 0, ringbufDirectMain, d);
+    if (r) {
+        free(d->buf);
+        free(d);
+        errno = r;
+        return 0;
+    }
+    return d;
+}
+
+int ringbufDirectFree(ringbuf_direct_t *d)
+{
+    #ifndef RINGBUF_NO_ASSERT
+    assert(d && *d);
+    #endif /* !RINGBUF_NO_ASSERT */
+    int r = ringbufDirectFlush(*d);
+    int saved_errno = errno;
+    __atomic_store_n(&(*d)->stop, 1, __ATOMIC_RELEASE);
+    pthread_join((*d)->thread, 0);
+    free((*d)->buf);
+    free(*d);
+    *d = 0;
+    errno = saved_errno;
+    return r;
+}
+
+int ringbufDirectWrite(ringbuf_direct_t d, const void *data, size_t len)
+{
+    int error = __atomic_load_n(&d->error, __ATOMIC_ACQUIRE);
+    if (error) {
+        errno = error;
+        return -1;
+    }
+    if (len > d->size) {
+        errno = EMSGSIZE;
+        return -1;
+    }
+    uint64_t head = d->head;
+    if (head + len - __atomic_load_n(&d->tail, __ATOMIC_ACQUIRE) > d->size) {
+        errno = EAGAIN;
+        return -1;
+    }
+
+    size_t off = head & (d->size - 1);
+    size_t n = d->size - off < len ? d->size - off : len;
+    memcpy(d->buf + off, data, n);
+    memcpy(d->buf, (const uint8_t *) data + n, len - n);
+    __atomic_store_n(&d->head, head + len, __ATOMIC_RELEASE);
+    return 0;
+}
+
+int ringbufDirectFlush(ringbuf_direct_t d)
+{
+    struct timespec wait = {0, 100000};
+    uint64_t req = d->head;
+
+    __atomic_store_n(&d->flush_req, req, __ATOMIC_RELEASE);
+    while (__atomic_load_n(&d->flushed, __ATOMIC_ACQUIRE) < req)
+        nanosleep(&wait, 0);
+    int error = __atomic_load_n(&d->error, __ATOMIC_ACQUIRE);
+    if (error) {
+        errno = error;
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Write the whole blocks between tail and head, at most half the ring
+ * per pwrite(2), and never across the end of the ring. Sets *head to
+ * the head it drained towards. Returns the number of bytes written.
+ */
+static size_t ringbufDirectDrain(ringbuf_direct_t d, uint64_t *head)
+{
+    *head = __atomic_load_n(&d->head, __ATOMIC_ACQUIRE);
+    uint64_t end = *head & ~(d->block - 1);
+    uint64_t tail = d->tail;
+    size_t total = 0;
+
+    while (tail < end) {
+        size_t off = tail & (d->size - 1);
+        size_t n = end - tail;
+        if (n > d->size - off)
+            n = d->size - off;
+        if (n > d->size / 2)
+            n = d->size / 2;
+        ssize_t w = pwrite(d->fd, d->buf + off, n, d->offset + tail);
+        if (w < 0 && errno == EINTR)
+            continue;
+        if (w < 0 || (uint64_t) w < d->block) {
+            __atomic_store_n(&d->error, w < 0 ? errno : EIO, __ATOMIC_RELEASE);
+            break;
+        }
+        /* keep tail block-aligned; a short write's tail end is redone */
+        w &= ~(d->block - 1);
+        tail += w;
+        total += w;
+        __atomic_store_n(&d->tail, tail, __ATOMIC_RELEASE);
+    }
+    return total;
+}
+
+/*
+ * Finish a flush up to req, once every whole block before it has been
+ * written: pad the partial block (if any) with zeros and write it,
+ * then truncate the file to end at req. The producer is waiting in
+ * ringbufDirectFlush, so head is req, and the padding is free space
+ * no one else is touching.
+ */
+static void ringbufDirectPad(ringbuf_direct_t d, uint64_t req)
+{
+    uint64_t tail = d->tail;
+    #ifndef RINGBUF_NO_ASSERT
+    assert(tail == (req & ~(d->block - 1)));
+    #endif /* !RINGBUF_NO_ASSERT */
+
+    if (req != tail) {
+        size_t off = tail & (d->size - 1);
+        size_t used = req - tail;
+        memset(d->buf + off + used, 0, d->block - used);
+        ssize_t w;
+        do
+            w = pwrite(d->fd, d->buf + off, d->block, d->offset + tail);
+        while (w < 0 && errno == EINTR);
+        if (w != (ssize_t) d->block)
+            __atomic_store_n(&d->error, w < 0 ? errno : EIO, __ATOMIC_RELEASE);
+    }
+    if (!d->error && ftruncate(d->fd, d->offset + req) < 0)
+        __atomic_store_n(&d->error, errno, __ATOMIC_RELEASE);
+}
+
+static void *ringbufDirectMain(void *arg)
+{
+    ringbuf_direct_t d = arg;
+    struct timespec idle = {0, 1000000};
+
+    for (;;) {
+        int stop = __atomic_load_n(&d->stop, __ATOMIC_ACQUIRE);
+        /*
+         * Load the flush request before draining: the producer only
+         * publishes it after its last append, so a drain that started
+         * later saw that append too.
+         */
+        uint64_t req = __atomic_load_n(&d->flush_req, __ATOMIC_ACQUIRE);
+        uint64_t head = 0;
+        size_t n = 0;
+        if (!d->error)
+            n = ringbufDirectDrain(d, &head);
+
+        if (req > d->flushed && (d->error || head >= req)) {
+            /* every whole block up to req is written, or writing failed */
+            if (!d->error)
+                ringbufDirectPad(d, req);
+            __atomic_store_n(&d->flushed, req, __ATOMIC_RELEASE);
+            continue;
+        }
+        if (n == 0) {
+            if (stop)
+                return 0;
+            nanosleep(&idle, 0);
+        }
+    }
+}
@@ -0,0 +1,106 @@
+#ifndef INCLUDED_RINGBUF_DIRECT_H
+#define INCLUDED_RINGBUF_DIRECT_H
+
+/*
+ * ringbuf-direct.h - background draining of a ring to a file in
+ * whole, aligned blocks, for O_DIRECT.
+ *
+ * To the extent possible under law, the author(s) have dedicated all
+ * copyright and related and neighboring rights to this software to
+ * the public domain worldwide. This software is distributed without
+ * any warranty.
+ *
+ * You should have received a copy of the CC0 Public Domain Dedication
+ * along with this software. If not, see
+ * <http://creativecommons.org/publicdomain/zero/1.0/>.
+ */
+
+/*
+ * Draining a ring buffer to a file with ringbufWrite issues writes of
+ * whatever length and alignment the ring happens to hold, through the
+ * page cache. A ringbuf_direct_t is meant for a file descriptor opened
+ * with O_DIRECT instead: its ring is aligned to the block size, and a
+ * background thread only ever writes whole blocks, at block-aligned
+ * file offsets, straight from the ring's memory.
+ *
+ * The last, partial block stays in the ring until more data completes
+ * it, or until ringbufDirectFlush pads it with zeros, writes it, and
+ * truncates the file back to the exact length written. The partial
+ * block stays in the ring after a flush, so later data is written
+ * over the padding.
+ *
+ * The drainer writes at most half the ring with each pwrite(2), so
+ * one half is always free for the producer while the other is going
+ * to disk (double buffering): the producer copies into the ring and
+ * returns, and never waits on the disk unless it calls
+ * ringbufDirectFlush. If it outruns the disk, ringbufDirectWrite
+ * fails instead of blocking.
+ *
+ * There is one producer: ringbufDirectWrite and ringbufDirectFlush
+ * must be called from one thread at a time.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct ringbuf_direct_s *ringbuf_direct_t;
+
+/*
+ * The default block size: a multiple of the logical block size of
+ * nearly every device.
+ */
+#define RINGBUF_DIRECT_BLOCK 4096
+
+/*
+ * Create a drainer that writes to fd, starting at file offset offset,
+ * through a ring of at least size bytes, and start its background
+ * thread. block is the alignment O_DIRECT requires of fd (0 for
+ * RINGBUF_DIRECT_BLOCK); it must be a power of two, and offset a
+ * multiple of it. The ring size is rounded up to a power of two of at
+ * least two blocks.
+ *
+ * Returns the new drainer, or 0 on failure (errno is set; EINVAL for
+ * a bad block size or offset).
+ */
+ringbuf_direct_t ringbufDirectNew(int fd, off_t offset, size_t size,
+                                  size_t block);
+
+/*
+ * Flush (see ringbufDirectFlush), stop the background thread,
+ * deallocate the drainer, and, as a side effect, set the pointer to 0.
+ * fd is not closed.
+ *
+ * Returns 0 on success, or -1 if any write failed (errno is set).
+ */
+int ringbufDirectFree(ringbuf_direct_t *d);
+
+/*
+ * Copy len bytes into the ring, for the background thread to write.
+ * Either all len bytes are queued, or none are.
+ *
+ * Returns 0 on success, or -1 with errno set to EAGAIN if there isn't
+ * room for them right now, to EMSGSIZE if there never will be (len is
+ * larger than the ring), or to the error of an earlier write that
+ * failed (after which the drainer writes nothing more).
+ */
+int ringbufDirectWrite(ringbuf_direct_t d, const void *data, size_t len);
+
+/*
+ * Wait until every byte queued so far is in the file: the whole
+ * blocks, plus the last partial block, padded to a whole block. The
+ * file is then truncated to end just after the last byte queued.
+ *
+ * Returns 0 on success, or -1 if a write failed (errno is set).
+ */
+int ringbufDirectFlush(ringbuf_direct_t d);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* INCLUDED_RINGBUF_DIRECT_H */
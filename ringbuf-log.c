@@ -0,0 +1,589 @@
+/*
+ * ringbuf-log.c - asynchronous binary logging through per-thread
+ * rings.
+ *
+ * To the extent possible under law, the author(s) have dedicated all
+ * copyright and related and neighboring rights to this software to
+ * the public domain worldwide. This software is distributed without
+ * any warranty.
+ *
+ * You should have received a copy of the CC0 Public Domain Dedication
+ * along with this software. If not, see
+ * <http://creativecommons.org/publicdomain/zero/1.0/>.
+ */
+
+#include "ringbuf-log.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#ifndef RINGBUF_NO_ASSERT
+#include <assert.h>
+#endif /* !RINGBUF_NO_ASSERT */
+
+/*
+ * A registered format, split into segments: each one is a run of
+ * literal text (with %% already collapsed) followed by at most one
+ * conversion spec, and the kind of argument it takes.
+ */
+enum ringbuf_log_kind
+{
+    RINGBUF_LOG_NONE,
+    RINGBUF_LOG_INT,
+    RINGBUF_LOG_UINT,
+    RINGBUF_LOG_LONG,
+    RINGBUF_LOG_ULONG,
+    RINGBUF_LOG_LLONG,
+    RINGBUF_LOG_ULLONG,
+    RINGBUF_LOG_SIZE,
+    RINGBUF_LOG_DOUBLE,
+    RINGBUF_LOG_STR,
+    RINGBUF_LOG_PTR
+};
+
+#define RINGBUF_LOG_SPEC 24
+
+struct ringbuf_log_seg
+{
+    size_t lit_off, lit_len;
+    char spec[RINGBUF_LOG_SPEC];
+    enum ringbuf_log_kind kind;
+};
+
+struct ringbuf_log_fmt
+{
+    char *text;
+    size_t nsegs;
+    size_t nstrs;               /* string arguments */
+    size_t fixed;               /* record bytes, not counting strings */
+    struct ringbuf_log_seg *segs;
+};
+
+/*
+ * Records are a 4-byte header (total length and format id) followed
+ * by the arguments: 8 bytes per scalar, and a 2-byte length plus the
+ * bytes for each string. Records are packed, and may wrap.
+ */
+#define RINGBUF_LOG_HDR 4
+
+/*
+ * One logging thread's ring. head and tail are ever-increasing byte
+ * positions; the owning thread moves head, the background thread
+ * moves tail, and then, once everything up to tail has been written
+ * to the file descriptor, moves written up to it.
+ */
+#define RINGBUF_LOG_LINE_SIZE 64
+
+struct ringbuf_log_ring
+{
+    uint64_t head;
+    char pad0[RINGBUF_LOG_LINE_SIZE - sizeof(uint64_t)];
+    uint64_t tail;
+    uint64_t written;
+    char pad1[RINGBUF_LOG_LINE_SIZE - 2 * sizeof(uint64_t)];
+    uint8_t *buf;
+    pthread_t owner;
+    struct ringbuf_log_ring *next;
+};
+
+/*
+ * The background thread formats into a set of fixed-size chunks, and
+ * writes all the chunks it filled with one writev(2) call.
+ */
+#define RINGBUF_LOG_CHUNKS 16
+#define RINGBUF_LOG_CHUNK 16384
+#define RINGBUF_LOG_LINE 4096
+
+struct ringbuf_log_s
+{
+    int fd;
+    int policy;
+    uint64_t size;
+    uint64_t serial;
+    pthread_t thread;
+    pthread_mutex_t lock;       /* registration of formats and rings */
+    struct ringbuf_log_ring *rings;
+    struct ringbuf_log_fmt *formats[RINGBUF_LOG_FORMATS];
+    int nformats;
+    int stop;
+    uint64_t dropped;
+
+    /* background thread only */
+    char chunks[RINGBUF_LOG_CHUNKS][RINGBUF_LOG_CHUNK];
+    struct iovec iov[RINGBUF_LOG_CHUNKS];
+    int niov;
+};
+
+/*
+ * Each thread caches its ring for the log it used last; serial
+ * numbers keep a new log allocated at a freed log's address from
+ * matching.
+ */
+static uint64_t ringbufLogSerial;
+static __thread uint64_t ringbufLogTlsSerial;
+static __thread struct ringbuf_log_ring *ringbufLogTlsRing;
+
+static void *ringbufLogMain(void *arg);
+
+ringbuf_log_t ringbufLogNew(int fd, size_t ring_size, int policy)
+{
+    uint64_t sz = RINGBUF_LOG_MAX;
+    while (sz < ring_size)
+        sz <<= 1;
+
+    ringbuf_log_t log = calloc(1, sizeof(struct ringbuf_log_s));
+    if (!log)
+        return 0;
+    log->fd = fd;
+    log->policy = policy;
+    log->size = sz;
+    log->serial = __atomic_add_fetch(&ringbufLogSerial, 1, __ATOMIC_RELAXED);
+    pthread_mutex_init(&log->lock, 0);
+    int r = pthread_create(&log->thread, 0, ringbufLogMain, log);
+    if (r) {
+        pthread_mutex_destroy(&log->lock);
+        free(log);
+        errno = r;
+        return 0;
+    }
+    return log;
+}
+
+void ringbufLogFree(ringbuf_log_t *log)
+{
+    #ifndef RINGBUF_NO_ASSERT
+    assert(log && *log);
+    #endif /* !RINGBUF_NO_ASSERT */
+    __atomic_store_n(&(*log)->stop, 1, __ATOMIC_RELEASE);
+    pthread_join((*log)->thread, 0);
+
+    struct ringbuf_log_ring *r = (*log)->rings;
+    while (r) {
+        struct ringbuf_log_ring *next = r->next;
+        free(r->buf);
+        free(r);
+        r = next;
+    }
+    for (int i = 0; i != (*log)->nformats; ++i) {
+        free((*log)->formats[i]->text);
+        free((*log)->formats[i]->segs);
+        free((*log)->formats[i]);
+    }
+    pthread_mutex_destroy(&(*log)->lock);
+    free(*log);
+    *log = 0;
+}
+
+/*
+ * Parse one conversion spec starting at p (just past the '%') into
+ * seg. Returns a pointer past the spec, or 0 if it isn't supported.
+ */
+static const char *ringbufLogParseSpec(const char *p,
+                                       struct ringbuf_log_seg *seg)
+{
+    const char *start = p - 1;
+    int longs = 0, size = 0;
+
+    p += strspn(p, "-+ #0'");
+    p += strspn(p, "0123456789");
+    if (*p == '.') {
+        ++p;
+        p += strspn(p, "0123456789");
+    }
+    if (*p == 'h')
+        p += p[1] == 'h' ? 2 : 1;
+    else if (*p == 'l')
+        longs = p[1] == 'l' ? 2 : 1, p += longs;
+    else if (*p == 'z')
+        size = 1, ++p;
+
+    switch (*p) {
+    case 'd': case 'i':
+        seg->kind = size ? RINGBUF_LOG_SIZE : longs == 2 ? RINGBUF_LOG_LLONG :
+            longs ? RINGBUF_LOG_LONG : RINGBUF_LOG_INT;
+        break;
+    case 'u': case 'o': case 'x': case 'X': case 'c':
+        seg->kind = size ? RINGBUF_LOG_SIZE : longs == 2 ? RINGBUF_LOG_ULLONG :
+            longs ? RINGBUF_LOG_ULONG : RINGBUF_LOG_UINT;
+        break;
+    case 'f': case 'F': case 'e': case 'E': case 'g': case 'G':
+    case 'a': case 'A':
+        seg->kind = RINGBUF_LOG_DOUBLE;
+        break;
+    case 's':
+        seg->kind = RINGBUF_LOG_STR;
+        break;
+    case 'p':
+        seg->kind = RINGBUF_LOG_PTR;
+        break;
+    default:
+        return 0;
+    }
+    ++p;
+    if (p - start >= RINGBUF_LOG_SPEC)
+        return 0;
+    memcpy(seg->spec, start, p - start);
+    seg->spec[p - start] = '\0';
+    return p;
+}
+
+int ringbufLogFormat(ringbuf_log_t log, const char *fmt)
+{
+    size_t len = strlen(fmt);
+    struct ringbuf_log_fmt *f = calloc(1, sizeof(struct ringbuf_log_fmt));
+    if (!f)
+        return -1;
+    f->text = malloc(len + 1);
+    /* every '%' starts a segment, plus one for the trailing text */
+    f->segs = calloc(len / 2 + 2, sizeof(struct ringbuf_log_seg));
+    if (!f->text || !f->segs)
+        goto fail;
+
+    size_t ntext = 0;
+    struct ringbuf_log_seg *seg = f->segs;
+    f->fixed = RINGBUF_LOG_HDR;
+    for (const char *p = fmt; *p; ) {
+        if (*p != '%') {
+            f->text[ntext++] = *p++;
+            continue;
+        }
+        if (p[1] == '%') {
+            f->text[ntext++] = '%';
+            p += 2;
+            continue;
+        }
+        seg->lit_len = ntext - seg->lit_off;
+        p = ringbufLogParseSpec(p + 1, seg);
+        if (!p)
+            goto fail;
+        if (seg->kind == RINGBUF_LOG_STR) {
+            f->fixed += 2;
+            ++f->nstrs;
+        } else
+            f->fixed += 8;
+        ++seg;
+        seg->lit_off = ntext;
+    }
+    seg->lit_len = ntext - seg->lit_off;
+    seg->kind = RINGBUF_LOG_NONE;
+    f->nsegs = seg - f->segs + 1;
+    f->text[ntext] = '\0';
+    if (f->fixed > RINGBUF_LOG_MAX)
+        goto fail;
+
+    pthread_mutex_lock(&log->lock);
+    int id = log->nformats;
+    if (id == RINGBUF_LOG_FORMATS) {
+        pthread_mutex_unlock(&log->lock);
+        goto fail;
+    }
+    log->formats[id] = f;
+    __atomic_store_n(&log->nformats, id + 1, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&log->lock);
+    return id;
+
+fail:
+    free(f->text);
+    free(f->segs);
+    free(f);
+    return -1;
+}
+
+/*
+ * Find or create the calling thread's ring.
+ */
+static struct ringbuf_log_ring *ringbufLogRingSlow(ringbuf_log_t log)
+{
+    pthread_t self = pthread_self();
+    struct ringbuf_log_ring *r;
+
+    pthread_mutex_lock(&log->lock);
+    for (r = log->rings; r; r = r->next)
+        if (pthread_equal(r->owner, self))
+            break;
+    if (!r) {
+        r = calloc(1, sizeof(struct ringbuf_log_ring));
+        if (r)
+            r->buf = malloc(log->size);
+        if (r && !r->buf) {
+            free(r);
+            r = 0;
+        }
+        if (r) {
+            /* fault the pages in now, not on the first pass */
+            memset(r->buf, 0, log->size);
+            r->owner = self;
+            r->next = log->rings;
+            __atomic_store_n(&log->rings, r, __ATOMIC_RELEASE);
+        }
+    }
+    pthread_mutex_unlock(&log->lock);
+
+    if (r) {
+        ringbufLogTlsSerial = log->serial;
+        ringbufLogTlsRing = r;
+    }
+    return r;
+}
+
+static struct ringbuf_log_ring *ringbufLogRing(ringbuf_log_t log)
+{
+    if (ringbufLogTlsSerial == log->serial)
+        return ringbufLogTlsRing;
+    return ringbufLogRingSlow(log);
+}
+
+int ringbufLog(ringbuf_log_t log, int id, ...)
+{
+    #ifndef RINGBUF_NO_ASSERT
+    assert(id >= 0 && id < __atomic_load_n(&log->nformats, __ATOMIC_ACQUIRE));
+    #endif /* !RINGBUF_NO_ASSERT */
+    const struct ringbuf_log_fmt *f = log->formats[id];
+    struct ringbuf_log_ring *r = ringbufLogRing(log);
+    uint8_t rec[RINGBUF_LOG_MAX];
+    size_t n = RINGBUF_LOG_HDR;
+    size_t strroom = RINGBUF_LOG_MAX - f->fixed;
+    va_list ap;
+
+    if (!r)
+        return -1;
+
+    /* copy the raw arguments */
+    va_start(ap, id);
+    for (size_t i = 0; i != f->nsegs; ++i) {
+        union { int64_t i; uint64_t u; double d; } v = {0};
+        switch (f->segs[i].kind) {
+        case RINGBUF_LOG_NONE:
+            continue;
+        case RINGBUF_LOG_INT: v.i = va_arg(ap, int); break;
+        case RINGBUF_LOG_UINT: v.u = va_arg(ap, unsigned); break;
+        case RINGBUF_LOG_LONG: v.i = va_arg(ap, long); break;
+        case RINGBUF_LOG_ULONG: v.u = va_arg(ap, unsigned long); break;
+        case RINGBUF_LOG_LLONG: v.i = va_arg(ap, long long); break;
+        case RINGBUF_LOG_ULLONG: v.u = va_arg(ap, unsigned long long); break;
+        case RINGBUF_LOG_SIZE: v.u = va_arg(ap, size_t); break;
+        case RINGBUF_LOG_DOUBLE: v.d = va_arg(ap, double); break;
+        case RINGBUF_LOG_PTR: v.u = (uintptr_t) va_arg(ap, void *); break;
+        case RINGBUF_LOG_STR: {
+            const char *s = va_arg(ap, const char *);
+            if (!s)
+                s = "(null)";
+            uint16_t len = strnlen(s, strroom);
+            memcpy(rec + n, &len, 2);
+            memcpy(rec + n + 2, s, len);
+            n += 2 + len;
+            strroom -= len;
+            continue;
+        }
+        }
+        memcpy(rec + n, &v, 8);
+        n += 8;
+    }
+    va_end(ap);
+    uint16_t hdr[2] = {(uint16_t) n, (uint16_t) id};
+    memcpy(rec, hdr, RINGBUF_LOG_HDR);
+
+    /* wait for, or give up on, room */
+    uint64_t head = r->head;
+    while (head + n - __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE) > log->size) {
+        if (log->policy == RINGBUF_LOG_DROP) {
+            __atomic_fetch_add(&log->dropped, 1, __ATOMIC_RELAXED);
+            return -1;
+        }
+        sched_yield();
+    }
+
+    size_t off = head & (log->size - 1);
+    size_t m = log->size - off < n ? log->size - off : n;
+    memcpy(r->buf + off, rec, m);
+    memcpy(r->buf, rec + m, n - m);
+    __atomic_store_n(&r->head, head + n, __ATOMIC_RELEASE);
+    return 0;
+}
+
+/*
+ * Write out the chunks filled so far, retrying short writes.
+ */
+static void ringbufLogWriteChunks(ringbuf_log_t log)
+{
+    struct iovec *iov = log->iov;
+    int niov = log->niov;
+
+    while (niov) {
+        ssize_t n = writev(log->fd, iov, niov);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            break;              /* nowhere to report it; drop the batch */
+        }
+        while (niov && (size_t) n >= iov->iov_len) {
+            n -= iov->iov_len;
+            ++iov;
+            --niov;
+        }
+        if (niov) {
+            iov->iov_base = (char *) iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+    log->niov = 0;
+}
+
+/*
+ * Append text to the current chunk, starting a new one (and writing
+ * out the batch if all chunks are full) when it doesn't fit.
+ */
+static void ringbufLogEmit(ringbuf_log_t log, const char *text, size_t len)
+{
+    struct iovec *cur = log->niov ? &log->iov[log->niov - 1] : 0;
+    if (!cur || cur->iov_len + len > RINGBUF_LOG_CHUNK) {
+        if (log->niov == RINGBUF_LOG_CHUNKS)
+            ringbufLogWriteChunks(log);
+        cur = &log->iov[log->niov];
+        cur->iov_base = log->chunks[log->niov];
+        cur->iov_len = 0;
+        ++log->niov;
+    }
+    memcpy((char *) cur->iov_base + cur->iov_len, text, len);
+    cur->iov_len += len;
+}
+
+/*
+ * Format one record into the output chunks.
+ */
+static void ringbufLogFormatRecord(ringbuf_log_t log, const uint8_t *rec)
+{
+    uint16_t hdr[2];
+    memcpy(hdr, rec, RINGBUF_LOG_HDR);
+    const struct ringbuf_log_fmt *f = log->formats[hdr[1]];
+    const uint8_t *arg = rec + RINGBUF_LOG_HDR;
+    char line[RINGBUF_LOG_LINE];
+    size_t n = 0;
+
+    for (size_t i = 0; i != f->nsegs; ++i) {
+        const struct ringbuf_log_seg *seg = &f->segs[i];
+        size_t lit = seg->lit_len < sizeof(line) - n ?
+            seg->lit_len : sizeof(line) - n;
+        memcpy(line + n, f->text + seg->lit_off, lit);
+        n += lit;
+        if (seg->kind == RINGBUF_LOG_NONE)
+            continue;
+
+        union { int64_t i; uint64_t u; double d; } v = {0};
+        char s[RINGBUF_LOG_MAX + 1];
+        char *out = line + n;
+        size_t room = sizeof(line) - n;
+        int m = 0;
+        if (seg->kind == RINGBUF_LOG_STR) {
+            uint16_t len;
+            memcpy(&len, arg, 2);
+            memcpy(s, arg + 2, len);
+            s[len] = '\0';
+            arg += 2 + len;
+        } else {
+            memcpy(&v, arg, 8);
+            arg += 8;
+        }
+        switch (seg->kind) {
+        case RINGBUF_LOG_NONE: break;
+        case RINGBUF_LOG_INT: m = snprintf(out, room, seg->spec, (int) v.i); break;
+        case RINGBUF_LOG_UINT: m = snprintf(out, room, seg->spec, (unsigned) v.u); break;
+        case RINGBUF_LOG_LONG: m = snprintf(out, room, seg->spec, (long) v.i); break;
+        case RINGBUF_LOG_ULONG: m = snprintf(out, room, seg->spec, (unsigned long) v.u); break;
+        case RINGBUF_LOG_LLONG: m = snprintf(out, room, seg->spec, (long long) v.i); break;
+        case RINGBUF_LOG_ULLONG: m = snprintf(out, room, seg->spec, (unsigned long long) v.u); break;
+        case RINGBUF_LOG_SIZE: m = snprintf(out, room, seg->spec, (size_t) v.u); break;
+        case RINGBUF_LOG_DOUBLE: m = snprintf(out, room, seg->spec, v.d); break;
+        case RINGBUF_LOG_PTR: m = snprintf(out, room, seg->spec, (void *) (uintptr_t) v.u); break;
+        case RINGBUF_LOG_STR: m = snprintf(out, room, seg->spec, s); break;
+        }
+        if (m > 0 && room)
+            n += (size_t) m < room ? (size_t) m : room - 1;
+    }
+    ringbufLogEmit(log, line, n);
+}
+
+/*
+ * Consume, format and write every record in every ring. Returns the
+ * number of records.
+ */
+static size_t ringbufLogDrain(ringbuf_log_t log)
+{
+    size_t nrecs = 0;
+    uint8_t rec[RINGBUF_LOG_MAX];
+
+    for (struct ringbuf_log_ring *r = __atomic_load_n(&log->rings, __ATOMIC_ACQUIRE);
+         r; r = r->next) {
+        uint64_t tail = r->tail;
+        uint64_t head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+        while (tail != head) {
+            size_t off = tail & (log->size - 1);
+            uint16_t len;
+            if (off + 2 <= log->size)
+                memcpy(&len, r->buf + off, 2);
+            else {
+                ((uint8_t *) &len)[0] = r->buf[off];
+                ((uint8_t *) &len)[1] = r->buf[0];
+            }
+            size_t m = log->size - off < len ? log->size - off : len;
+            memcpy(rec, r->buf + off, m);
+            memcpy(rec + m, r->buf, len - m);
+            ringbufLogFormatRecord(log, rec);
+            tail += len;
+            ++nrecs;
+        }
+        __atomic_store_n(&r->tail, tail, __ATOMIC_RELEASE);
+    }
+    ringbufLogWriteChunks(log);
+
+    for (struct ringbuf_log_ring *r = __atomic_load_n(&log->rings, __ATOMIC_ACQUIRE);
+         r; r = r->next)
+        __atomic_store_n(&r->written, r->tail, __ATOMIC_RELEASE);
+    return nrecs;
+}
+
+static void *ringbufLogMain(void *arg)
+{
+    ringbuf_log_t log = arg;
+    struct timespec idle = {0, 1000000};
+
+    for (;;) {
+        int stop = __atomic_load_n(&log->stop, __ATOMIC_ACQUIRE);
+        size_t n = ringbufLogDrain(log);
+        if (n == 0) {
+            if (stop)
+                return 0;
+            nanosleep(&idle, 0);
+        }
+    }
+}
+
+void ringbufLogFlush(ringbuf_log_t log)
+{
+    struct timespec wait = {0, 100000};
+
+    /*
+     * Rings are only ever added at the front of the list, so this
+     * visits every ring that existed when the call was made.
+     */
+    for (struct ringbuf_log_ring *r = __atomic_load_n(&log->rings, __ATOMIC_ACQUIRE);
+         r; r = r->next) {
+        uint64_t head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+        while (__atomic_load_n(&r->written, __ATOMIC_ACQUIRE) < head)
+            nanosleep(&wait, 0);
+    }
+}
+
+uint64_t ringbufLogDropped(const struct ringbuf_log_s *log)
+{
+    return __atomic_load_n(&log->dropped, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,119 @@
+#ifndef INCLUDED_RINGBUF_LOG_H
+#define INCLUDED_RINGBUF_LOG_H
+
+/*
+ * ringbuf-log.h - asynchronous binary logging through per-thread
+ * rings.
+ *
+ * To the extent possible under law, the author(s) have dedicated all
+ * copyright and related and neighboring rights to this software to
+ * the public domain worldwide. This software is distributed without
+ * any warranty.
+ *
+ * You should have received a copy of the CC0 Public Domain Dedication
+ * along with this software. If not, see
+ * <http://creativecommons.org/publicdomain/zero/1.0/>.
+ */
+
+/*
+ * Formatting a log message and writing it under a lock puts both
+ * costs on the caller. With a ringbuf_log_t, call sites register
+ * their printf-style formats once, and each log call only copies the
+ * format id and the raw argument values into a ring owned by the
+ * calling thread (single producer, single consumer: no locks, just an
+ * acquire load and a release store). A background thread drains the
+ * rings, formats the messages, and writes them to the log's file
+ * descriptor in batches with writev(2).
+ *
+ * A call with a handful of arguments costs a few tens of nanoseconds
+ * on the calling thread; the formatting, which costs far more, is
+ * paid by the background thread. That only stays off the logging
+ * threads' time when the background thread has a CPU of its own: on
+ * a machine with fewer CPUs than busy threads it runs on theirs, and
+ * the average cost per call seen by a logging thread rises to
+ * include it (see ringbuf-bench log).
+ *
+ * Supported conversions are those of printf(3) for int, long, long
+ * long, size_t, double, char *, and void * arguments (flags, width
+ * and precision included, but not '*'), and %%. Strings are copied
+ * (truncated, if the record would exceed RINGBUF_LOG_MAX bytes).
+ *
+ * Messages from one thread are written in order; messages from
+ * different threads interleave in no particular order. Each thread's
+ * ring is created on its first log call and kept until the log is
+ * freed.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct ringbuf_log_s *ringbuf_log_t;
+
+/*
+ * What to do when the calling thread's ring is full: drop the message
+ * (and count it), or wait for the background thread to make room.
+ */
+#define RINGBUF_LOG_DROP 0
+#define RINGBUF_LOG_BLOCK 1
+
+/*
+ * The largest record (format id plus arguments) one log call can
+ * produce, and the largest number of formats a log can register.
+ */
+#define RINGBUF_LOG_MAX 512
+#define RINGBUF_LOG_FORMATS 1024
+
+/*
+ * Create a log writing to fd, with a ring of at least ring_size bytes
+ * (rounded up to a power of two) per logging thread, and start its
+ * background thread. policy is RINGBUF_LOG_DROP or RINGBUF_LOG_BLOCK.
+ *
+ * Returns the new log, or 0 on failure (errno is set).
+ */
+ringbuf_log_t ringbufLogNew(int fd, size_t ring_size, int policy);
+
+/*
+ * Write out every message logged so far, stop the background thread,
+ * deallocate the log, and, as a side effect, set the pointer to 0. No
+ * other thread may be using the log. fd is not closed.
+ */
+void ringbufLogFree(ringbuf_log_t *log);
+
+/*
+ * Register a format string (which is copied). Any thread may call
+ * this at any time.
+ *
+ * Returns the format's id, for use with ringbufLog, or -1 if fmt has
+ * an unsupported conversion or there are already RINGBUF_LOG_FORMATS
+ * formats.
+ */
+int ringbufLogFormat(ringbuf_log_t log, const char *fmt);
+
+/*
+ * Log a message with the format registered as id; the arguments must
+ * match it, as for printf(3). No formatting happens here.
+ *
+ * Returns 0 on success, or -1 if the message was dropped.
+ */
+int ringbufLog(ringbuf_log_t log, int id, ...);
+
+/*
+ * Wait until every message logged (by any thread) before the call has
+ * been written to fd.
+ */
+void ringbufLogFlush(ringbuf_log_t log);
+
+/*
+ * The number of messages dropped so far because a ring was full.
+ */
+uint64_t ringbufLogDropped(const struct ringbuf_log_s *log);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* INCLUDED_RINGBUF_LOG_H */
@@ -0,0 +1,341 @@
+/*
+ * ringbuf-percpu.c - per-CPU record rings for many producers and one
+ * consumer.
+ *
+ * To the extent possible under law, the author(s) have dedicated all
+ * copyright and related and neighboring rights to this software to
+ * the public domain worldwide. This software is distributed without
+ * any warranty.
+ *
+ * You should have received a copy of the CC0 Public Domain Dedication
+ * along with this software. If not, see
+ * <http://creativecommons.org/publicdomain/zero/1.0/>.
+ */
+
+#ifdef __linux__
+#define _GNU_SOURCE     /* sched_getcpu(3) */
+#endif
+
+#include "ringbuf-percpu.h"
+
+#ifdef __linux__
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/*
+ * Define RINGBUF_PERCPU_NO_RSEQ to always use the locked fallback.
+ */
+#if defined(__x86_64__) && defined(__has_include) && \
+    !defined(RINGBUF_PERCPU_NO_RSEQ)
+#if __has_include(<sys/rseq.h>)
+#include <sys/rseq.h>
+#define RINGBUF_PERCPU_RSEQ 1
+#endif
+#endif
+
+#ifndef RINGBUF_NO_ASSERT
+#include <assert.h>
+#endif /* !RINGBUF_NO_ASSERT */
+
+/*
+ * Every record starts on a 16-byte boundary with this header, so a
+ * header never wraps; only the data after it can. ready is 0 while
+ * the record is reserved, and set by the producer once the record is
+ * complete. Records vary in length, so the next lap's headers can
+ * land anywhere in a consumed record: the consumer clears the ready
+ * word of every 16-byte slot in it before releasing the space.
+ */
+struct ringbuf_percpu_rec
+{
+    uint32_t len;
+    uint32_t ready;
+    uint64_t key;
+};
+
+#define RINGBUF_PERCPU_ALIGN 16
+#define RINGBUF_PERCPU_LINE 64
+
+/*
+ * head and tail are ever-increasing byte positions, masked to find
+ * the offset in buf. Only producers on this ring's CPU (or holding
+ * lock) move head, only the consumer moves tail.
+ */
+struct ringbuf_percpu_ring
+{
+    uint64_t head;
+    char pad0[RINGBUF_PERCPU_LINE - sizeof(uint64_t)];
+    uint64_t tail;
+    char pad1[RINGBUF_PERCPU_LINE - sizeof(uint64_t)];
+    uint8_t *buf;
+    pthread_mutex_t lock;       /* fallback reservations only */
+};
+
+struct ringbuf_percpu_s
+{
+    unsigned nrings;
+    int use_rseq;
+    uint64_t size;
+    struct ringbuf_percpu_ring *rings;
+    uint8_t *scratch;           /* for records whose data wraps */
+};
+
+ringbuf_percpu_t ringbufPercpuNew(size_t size)
+{
+    uint64_t sz = RINGBUF_PERCPU_ALIGN;
+    while (sz < size)
+        sz <<= 1;
+    long ncpus = sysconf(_SC_NPROCESSORS_CONF);
+    if (ncpus < 1)
+        ncpus = 1;
+
+    ringbuf_percpu_t pc = calloc(1, sizeof(struct ringbuf_percpu_s));
+    if (!pc)
+        return 0;
+    pc->nrings = ncpus;
+    pc->size = sz;
+    pc->rings = calloc(ncpus, sizeof(struct ringbuf_percpu_ring));
+    pc->scratch = malloc(sz);
+    if (!pc->rings || !pc->scratch) {
+        free(pc->rings);
+        free(pc->scratch);
+        free(pc);
+        return 0;
+    }
+    for (unsigned i = 0; i != pc->nrings; ++i) {
+        pthread_mutex_init(&pc->rings[i].lock, 0);
+        pc->rings[i].buf = calloc(1, sz);
+        if (!pc->rings[i].buf) {
+            ringbufPercpuFree(&pc);
+            return 0;
+        }
+    }
+#ifdef RINGBUF_PERCPU_RSEQ
+    pc->use_rseq = __rseq_size > 0;
+#endif
+    return pc;
+}
+
+void ringbufPercpuFree(ringbuf_percpu_t *pc)
+{
+    #ifndef RINGBUF_NO_ASSERT
+    assert(pc && *pc);
+    #endif /* !RINGBUF_NO_ASSERT */
+    for (unsigned i = 0; i != (*pc)->nrings; ++i) {
+        pthread_mutex_destroy(&(*pc)->rings[i].lock);
+        free((*pc)->rings[i].buf);
+    }
+    free((*pc)->rings);
+    free((*pc)->scratch);
+    free(*pc);
+    *pc = 0;
+}
+
+int ringbufPercpuUsesRseq(const struct ringbuf_percpu_s *pc)
+{
+    return pc->use_rseq;
+}
+
+static size_t ringbufPercpuStride(size_t len)
+{
+    return (sizeof(struct ringbuf_percpu_rec) + len + RINGBUF_PERCPU_ALIGN - 1) &
+        ~(size_t) (RINGBUF_PERCPU_ALIGN - 1);
+}
+
+#ifdef RINGBUF_PERCPU_RSEQ
+
+#define RINGBUF_RSEQ_SIG 0x53053053
+
+/*
+ * Reserve need bytes in the ring of the CPU the thread is running on,
+ * as a restartable sequence: check that we're still on cpu, check for
+ * room against the consumer's tail, and commit the new head with a
+ * single store. If the kernel preempts or migrates the thread before
+ * the commit, it resumes at the abort handler, and we start over with
+ * the new CPU. Returns the ring, with *pos set to the reserved
+ * position, or 0 if the ring is full.
+ */
+static struct ringbuf_percpu_ring *
+ringbufPercpuReserveRseq(ringbuf_percpu_t pc, uint64_t need, uint64_t *pos)
+{
+    struct rseq *rs = (struct rseq *)
+        ((char *) __builtin_thread_pointer() + __rseq_offset);
+
+    for (;;) {
+        uint32_t cpu = __atomic_load_n(&rs->cpu_id_start, __ATOMIC_RELAXED);
+        struct ringbuf_percpu_ring *r = &pc->rings[cpu % pc->nrings];
+
+        __asm__ __volatile__ goto (
+            ".pushsection __rseq_cs, \"aw\"\n\t"
+            ".balign 32\n\t"
+            "3:\n\t"
+            ".long 0x0, 0x0\n\t"
+            ".quad 1f, (2f - 1f), 4f\n\t"
+            ".popsection\n\t"
+            "leaq 3b(%%rip), %%rax\n\t"
+            "movq %%rax, 8(%[rs])\n\t"
+            "1:\n\t"
+            "cmpl %[cpu], 4(%[rs])\n\t"
+            "jnz %l[abort]\n\t"
+            "movq (%[head]), %%rcx\n\t"
+            "leaq (%%rcx, %[need]), %%rdx\n\t"
+            "movq %%rdx, %%rax\n\t"
+            "subq (%[tail]), %%rax\n\t"
+            "cmpq %[size], %%rax\n\t"
+            "ja %l[full]\n\t"
+            "movq %%rcx, (%[pos])\n\t"
+            "movq %%rdx, (%[head])\n\t"
+            "2:\n\t"
+            ".pushsection __rseq_failure, \"ax\"\n\t"
+            ".long %c[sig]\n\t"
+            "4:\n\t"
+            "jmp %l[abort]\n\t"
+            ".popsection\n\t"
+            :
+            : [rs] "r" (rs), [cpu] "r" (cpu), [head] "r" (&r->head),
+              [tail] "r" (&r->tail), [need] "r" (need),
+              [size] "r" (pc->size), [pos] "r" (pos),
+              [sig] "i" (RINGBUF_RSEQ_SIG)
+            : "memory", "cc", "rax", "rcx", "rdx"
+            : abort, full);
+        return r;
+    abort:
+        continue;
+    full:
+        return 0;
+    }
+}
+
+#endif /* RINGBUF_PERCPU_RSEQ */
+
+static struct ringbuf_percpu_ring *
+ringbufPercpuReserveLocked(ringbuf_percpu_t pc, uint64_t need, uint64_t *pos)
+{
+    int cpu = sched_getcpu();
+    struct ringbuf_percpu_ring *r =
+        &pc->rings[cpu < 0 ? 0 : (unsigned) cpu % pc->nrings];
+
+    pthread_mutex_lock(&r->lock);
+    uint64_t head = r->head;
+    int full = head + need - __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE) >
+        pc->size;
+    if (!full) {
+        *pos = head;
+        r->head = head + need;
+    }
+    pthread_mutex_unlock(&r->lock);
+    return full ? 0 : r;
+}
+
+/*
+ * Copy len bytes between a ring buffer position and flat memory, in
+ * up to two pieces.
+ */
+static void ringbufPercpuCopyIn(const struct ringbuf_percpu_s *pc,
+                                uint8_t *buf, uint64_t pos,
+                                const void *src, size_t len)
+{
+    size_t off = pos & (pc->size - 1);
+    size_t n = pc->size - off < len ? pc->size - off : len;
+    memcpy(buf + off, src, n);
+    memcpy(buf, (const uint8_t *) src + n, len - n);
+}
+
+static void ringbufPercpuCopyOut(const struct ringbuf_percpu_s *pc,
+                                 void *dst, const uint8_t *buf,
+                                 uint64_t pos, size_t len)
+{
+    size_t off = pos & (pc->size - 1);
+    size_t n = pc->size - off < len ? pc->size - off : len;
+    memcpy(dst, buf + off, n);
+    memcpy((uint8_t *) dst + n, buf, len - n);
+}
+
+int ringbufPercpuAppend(ringbuf_percpu_t pc, uint64_t key,
+                        const void *data, size_t len)
+{
+    uint64_t need = ringbufPercpuStride(len);
+    uint64_t pos;
+    struct ringbuf_percpu_ring *r;
+
+    if (need > pc->size)
+        return -1;
+#ifdef RINGBUF_PERCPU_RSEQ
+    if (pc->use_rseq)
+        r = ringbufPercpuReserveRseq(pc, need, &pos);
+    else
+#endif
+        r = ringbufPercpuReserveLocked(pc, need, &pos);
+    if (!r)
+        return -1;
+
+    /* the space is ours now, wherever we get migrated to */
+    struct ringbuf_percpu_rec *rec = (struct ringbuf_percpu_rec *)
+        (r->buf + (pos & (pc->size - 1)));
+    rec->len = len;
+    rec->key = key;
+    ringbufPercpuCopyIn(pc, r->buf, pos + sizeof(*rec), data, len);
+    __atomic_store_n(&rec->ready, 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+/*
+ * The oldest record in r, if it has been published, or 0.
+ */
+static struct ringbuf_percpu_rec *
+ringbufPercpuFirst(const struct ringbuf_percpu_s *pc,
+                   const struct ringbuf_percpu_ring *r)
+{
+    uint64_t tail = r->tail;
+    if (tail == __atomic_load_n(&r->head, __ATOMIC_ACQUIRE))
+        return 0;
+    struct ringbuf_percpu_rec *rec = (struct ringbuf_percpu_rec *)
+        (r->buf + (tail & (pc->size - 1)));
+    if (!__atomic_load_n(&rec->ready, __ATOMIC_ACQUIRE))
+        return 0;
+    return rec;
+}
+
+size_t ringbufPercpuDrain(ringbuf_percpu_t pc, ringbuf_percpu_fn fn,
+                          void *arg)
+{
+    size_t n = 0;
+
+    for (;;) {
+        struct ringbuf_percpu_ring *best = 0;
+        struct ringbuf_percpu_rec *rec = 0;
+        for (unsigned i = 0; i != pc->nrings; ++i) {
+            struct ringbuf_percpu_rec *first =
+                ringbufPercpuFirst(pc, &pc->rings[i]);
+            if (first && (!rec || first->key < rec->key)) {
+                best = &pc->rings[i];
+                rec = first;
+            }
+        }
+        if (!rec)
+            return n;
+
+        uint64_t tail = best->tail;
+        size_t len = rec->len;
+        size_t off = (tail + sizeof(*rec)) & (pc->size - 1);
+        if (off + len <= pc->size)
+            fn(arg, rec->key, best->buf + off, len);
+        else {
+            ringbufPercpuCopyOut(pc, pc->scratch, best->buf,
+                                 tail + sizeof(*rec), len);
+            fn(arg, rec->key, pc->scratch, len);
+        }
+        size_t stride = ringbufPercpuStride(len);
+        for (uint64_t pos = tail; pos != tail + stride;
+             pos += RINGBUF_PERCPU_ALIGN)
+            ((struct ringbuf_percpu_rec *)
+             (best->buf + (pos & (pc->size - 1))))->ready = 0;
+        __atomic_store_n(&best->tail, tail + stride, __ATOMIC_RELEASE);
+        ++n;
+    }
+}
+
+#endif /* __linux__ */
@@ -0,0 +1,109 @@
+#ifndef INCLUDED_RINGBUF_PERCPU_H
+#define INCLUDED_RINGBUF_PERCPU_H
+
+/*
+ * ringbuf-percpu.h - per-CPU record rings for many producers and one
+ * consumer.
+ *
+ * To the extent possible under law, the author(s) have dedicated all
+ * copyright and related and neighboring rights to this software to
+ * the public domain worldwide. This software is distributed without
+ * any warranty.
+ *
+ * You should have received a copy of the CC0 Public Domain Dedication
+ * along with this software. If not, see
+ * <http://creativecommons.org/publicdomain/zero/1.0/>.
+ */
+
+/*
+ * When many threads append to one shared ring buffer, they all
+ * contend on its head. A ringbuf_percpu_t has one ring per CPU
+ * instead: a producer appends to the ring of the CPU it is running
+ * on, and a single consumer drains all of them, merging records by a
+ * caller-supplied key (e.g., a timestamp).
+ *
+ * On x86-64 Linux with restartable sequences (rseq(2), registered by
+ * glibc 2.35 and later), space is reserved in the CPU's ring by a
+ * restartable sequence: if the thread is preempted or migrated in the
+ * middle of the reservation, the kernel restarts it, so the fast path
+ * needs no locks and no atomic read-modify-write instructions. Once
+ * space is reserved, the record is copied in and published with a
+ * plain release store; a migration after the reservation is harmless,
+ * since the space belongs to the producer. Elsewhere, reservations
+ * fall back to sched_getcpu(3) plus a per-ring lock.
+ *
+ * Records are published in place, so the consumer stops at the first
+ * record in each ring that is reserved but not yet published, and
+ * picks it up on a later drain.
+ *
+ * Only available on Linux.
+ */
+
+#ifdef __linux__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct ringbuf_percpu_s *ringbuf_percpu_t;
+
+/*
+ * Create one ring per configured CPU, each with a buffer of at least
+ * size bytes (rounded up to a power of two). Each record takes 16
+ * bytes of header plus its length, rounded up to 16.
+ *
+ * Returns the new rings, or 0 if there isn't enough memory.
+ */
+ringbuf_percpu_t ringbufPercpuNew(size_t size);
+
+/*
+ * Deallocate the rings, and, as a side effect, set the pointer to 0.
+ * No thread may be using them.
+ */
+void ringbufPercpuFree(ringbuf_percpu_t *pc);
+
+/*
+ * Is the restartable-sequence fast path in use? Returns 1 if so, 0
+ * if appends use the locked fallback.
+ */
+int ringbufPercpuUsesRseq(const struct ringbuf_percpu_s *pc);
+
+/*
+ * Append a record of len bytes with the given merge key to the ring
+ * of the calling thread's current CPU. Any number of threads may call
+ * this concurrently.
+ *
+ * Returns 0 on success, or -1 if the ring is full or the record could
+ * never fit (nothing is appended; it's up to the caller to retry or
+ * drop the record).
+ */
+int ringbufPercpuAppend(ringbuf_percpu_t pc, uint64_t key,
+                        const void *data, size_t len);
+
+/*
+ * Called by ringbufPercpuDrain with each record, in one contiguous
+ * piece. data is only valid during the call.
+ */
+typedef void (*ringbuf_percpu_fn)(void *arg, uint64_t key,
+                                  const void *data, size_t len);
+
+/*
+ * Consume every published record from all rings, merging them in key
+ * order (records from the same ring are never reordered), and call fn
+ * with each of them. Only one thread may drain at a time.
+ *
+ * Returns the number of records consumed.
+ */
+size_t ringbufPercpuDrain(ringbuf_percpu_t pc, ringbuf_percpu_fn fn,
+                          void *arg);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __linux__ */
+
+#endif /* INCLUDED_RINGBUF_PERCPU_H */
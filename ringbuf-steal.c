@@ -0,0 +1,207 @@
+/*
+ * ringbuf-steal.c - work-stealing pool of per-worker job rings.
+ *
+ * To the extent possible under law, the author(s) have dedicated all
+ * copyright and related and neighboring rights to this software to
+ * the public domain worldwide. This software is distributed without
+ * any warranty.
+ *
+ * You should have received a copy of the CC0 Public Domain Dedication
+ * along with this software. If not, see
+ * <http://creativecommons.org/publicdomain/zero/1.0/>.
+ */
+
+#include "ringbuf-steal.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#ifndef RINGBUF_NO_ASSERT
+#include <assert.h>
+#endif /* !RINGBUF_NO_ASSERT */
+
+/*
+ * The deque follows Le, Pop, Cohen and Zappa Nardelli, "Correct and
+ * Efficient Work-Stealing for Weak Memory Models" (PPoPP 2013), minus
+ * the resizing: top and bottom are ever-increasing indices, masked to
+ * find a slot. The owner works at bottom, thieves at top. They are
+ * kept on separate cache lines, so that the owner's pushes and pops
+ * don't bounce the line thieves are spinning on.
+ */
+#define RINGBUF_STEAL_LINE 64
+
+struct ringbuf_steal_ring
+{
+    int64_t top;
+    char pad0[RINGBUF_STEAL_LINE - sizeof(int64_t)];
+    int64_t bottom;
+    char pad1[RINGBUF_STEAL_LINE - sizeof(int64_t)];
+    void **jobs;
+    int64_t mask;
+    char pad2[RINGBUF_STEAL_LINE - sizeof(void **) - sizeof(int64_t)];
+};
+
+struct ringbuf_steal_s
+{
+    unsigned nworkers;
+    struct ringbuf_steal_ring *rings;
+};
+
+ringbuf_steal_t ringbufStealNew(unsigned nworkers, size_t capacity)
+{
+    size_t cap = 1;
+    while (cap < capacity)
+        cap <<= 1;
+
+    ringbuf_steal_t pool = malloc(sizeof(struct ringbuf_steal_s));
+    if (!pool)
+        return 0;
+    pool->nworkers = nworkers;
+    pool->rings = calloc(nworkers, sizeof(struct ringbuf_steal_ring));
+    if (!pool->rings) {
+        free(pool);
+        return 0;
+    }
+    for (unsigned i = 0; i != nworkers; ++i) {
+        pool->rings[i].jobs = malloc(cap * sizeof(void *));
+        pool->rings[i].mask = cap - 1;
+        if (!pool->rings[i].jobs) {
+            ringbufStealFree(&pool);
+            return 0;
+        }
+    }
+    return pool;
+}
+
+void ringbufStealFree(ringbuf_steal_t *pool)
+{
+    #ifndef RINGBUF_NO_ASSERT
+    assert(pool && *pool);
+    #endif /* !RINGBUF_NO_ASSERT */
+    for (unsigned i = 0; i != (*pool)->nworkers; ++i)
+        free((*pool)->rings[i].jobs);
+    free((*pool)->rings);
+    free(*pool);
+    *pool = 0;
+}
+
+unsigned ringbufStealWorkers(const struct ringbuf_steal_s *pool)
+{
+    return pool->nworkers;
+}
+
+int ringbufStealPush(ringbuf_steal_t pool, unsigned worker, void *job)
+{
+    struct ringbuf_steal_ring *r = &pool->rings[worker];
+    #ifndef RINGBUF_NO_ASSERT
+    assert(worker < pool->nworkers && job);
+    #endif /* !RINGBUF_NO_ASSERT */
+    int64_t b = __atomic_load_n(&r->bottom, __ATOMIC_RELAXED);
+    int64_t t = __atomic_load_n(&r->top, __ATOMIC_ACQUIRE);
+    if (b - t > r->mask)
+        return -1;
+    __atomic_store_n(&r->jobs[b & r->mask], job, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    __atomic_store_n(&r->bottom, b + 1, __ATOMIC_RELAXED);
+    return 0;
+}
+
+void *ringbufStealPop(ringbuf_steal_t pool, unsigned worker)
+{
+    struct ringbuf_steal_ring *r = &pool->rings[worker];
+    #ifndef RINGBUF_NO_ASSERT
+    assert(worker < pool->nworkers);
+    #endif /* !RINGBUF_NO_ASSERT */
+    int64_t b = __atomic_load_n(&r->bottom, __ATOMIC_RELAXED) - 1;
+    __atomic_store_n(&r->bottom, b, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    int64_t t = __atomic_load_n(&r->top, __ATOMIC_RELAXED);
+
+    if (t > b) {
+        /* empty */
+        __atomic_store_n(&r->bottom, b + 1, __ATOMIC_RELAXED);
+        return 0;
+    }
+    void *job = __atomic_load_n(&r->jobs[b & r->mask], __ATOMIC_RELAXED);
+    if (t == b) {
+        /* the last job: race the thieves for it */
+        if (!__atomic_compare_exchange_n(&r->top, &t, t + 1, 0,
+                                         __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+            job = 0;
+        __atomic_store_n(&r->bottom, b + 1, __ATOMIC_RELAXED);
+    }
+    return job;
+}
+
+/*
+ * Steal the oldest job from r. Returns 0 if r is empty or another
+ * thread took the job first.
+ */
+static void *ringbufStealOne(struct ringbuf_steal_ring *r)
+{
+    int64_t t = __atomic_load_n(&r->top, __ATOMIC_ACQUIRE);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    int64_t b = __atomic_load_n(&r->bottom, __ATOMIC_ACQUIRE);
+    if (t >= b)
+        return 0;
+    void *job = __atomic_load_n(&r->jobs[t & r->mask], __ATOMIC_RELAXED);
+    if (!__atomic_compare_exchange_n(&r->top, &t, t + 1, 0,
+                                     __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+        return 0;
+    return job;
+}
+
+size_t ringbufStealBatch(ringbuf_steal_t pool, unsigned thief,
+                         unsigned victim, size_t max)
+{
+    struct ringbuf_steal_ring *v = &pool->rings[victim];
+    struct ringbuf_steal_ring *own = &pool->rings[thief];
+    #ifndef RINGBUF_NO_ASSERT
+    assert(thief < pool->nworkers && victim < pool->nworkers);
+    assert(thief != victim);
+    #endif /* !RINGBUF_NO_ASSERT */
+
+    /* take at most half of what the victim has queued right now */
+    int64_t avail = __atomic_load_n(&v->bottom, __ATOMIC_ACQUIRE) -
+        __atomic_load_n(&v->top, __ATOMIC_ACQUIRE);
+    if (avail <= 0)
+        return 0;
+    if ((size_t) (avail + 1) / 2 < max)
+        max = (avail + 1) / 2;
+
+    /* never steal more than fits */
+    int64_t room = own->mask + 1 -
+        (__atomic_load_n(&own->bottom, __ATOMIC_RELAXED) -
+         __atomic_load_n(&own->top, __ATOMIC_ACQUIRE));
+    if ((size_t) room < max)
+        max = room;
+
+    size_t n = 0;
+    while (n != max) {
+        void *job = ringbufStealOne(v);
+        if (!job)
+            break;
+        ringbufStealPush(pool, thief, job);
+        ++n;
+    }
+    return n;
+}
+
+void *ringbufStealNext(ringbuf_steal_t pool, unsigned worker)
+{
+    void *job = ringbufStealPop(pool, worker);
+    if (job)
+        return job;
+
+    struct ringbuf_steal_ring *own = &pool->rings[worker];
+    for (unsigned i = 1; i < pool->nworkers; ++i) {
+        unsigned victim = (worker + i) % pool->nworkers;
+        if (ringbufStealBatch(pool, worker, victim, own->mask + 1)) {
+            /* another thief may beat us to a one-job batch */
+            job = ringbufStealPop(pool, worker);
+            if (job)
+                return job;
+        }
+    }
+    return 0;
+}
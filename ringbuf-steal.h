@@ -0,0 +1,104 @@
+#ifndef INCLUDED_RINGBUF_STEAL_H
+#define INCLUDED_RINGBUF_STEAL_H
+
+/*
+ * ringbuf-steal.h - work-stealing pool of per-worker job rings.
+ *
+ * To the extent possible under law, the author(s) have dedicated all
+ * copyright and related and neighboring rights to this software to
+ * the public domain worldwide. This software is distributed without
+ * any warranty.
+ *
+ * You should have received a copy of the CC0 Public Domain Dedication
+ * along with this software. If not, see
+ * <http://creativecommons.org/publicdomain/zero/1.0/>.
+ */
+
+/*
+ * A ringbuf_steal_t holds one fixed-size ring of jobs (opaque void *
+ * pointers) per worker thread. Each ring is a bounded Chase-Lev
+ * deque: its owner pushes and pops jobs at the head end with no
+ * read-modify-write atomics unless the ring is down to its last job,
+ * while idle workers steal from the tail end with one compare-and-swap
+ * per job. So when load is skewed, idle workers drain the backlog of
+ * busy ones instead of sitting idle.
+ *
+ * Byte ring buffers (ringbuf_t) can't be shared between threads this
+ * way, which is why the job rings are a separate type.
+ *
+ * Every worker index passed as "worker" or "thief" below identifies
+ * the calling thread's own ring: only one thread may act as the owner
+ * of a given ring. Any thread may steal from any ring.
+ */
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct ringbuf_steal_s *ringbuf_steal_t;
+
+/*
+ * Create a pool of nworkers job rings, each of which can hold at
+ * least capacity jobs (the capacity is rounded up to a power of two).
+ *
+ * Returns the new pool, or 0 if there isn't enough memory.
+ */
+ringbuf_steal_t ringbufStealNew(unsigned nworkers, size_t capacity);
+
+/*
+ * Deallocate a pool, and, as a side effect, set the pointer to 0. Jobs
+ * still queued are dropped. No thread may be using the pool.
+ */
+void ringbufStealFree(ringbuf_steal_t *pool);
+
+/*
+ * The number of job rings in the pool.
+ */
+unsigned ringbufStealWorkers(const struct ringbuf_steal_s *pool);
+
+/*
+ * Queue job, which must not be 0, on worker's own ring. Only worker's
+ * owner may call this. (Producers that aren't workers should hand
+ * jobs to a worker by other means, e.g., a ring buffer.)
+ *
+ * Returns 0 on success, or -1 if the ring is full.
+ */
+int ringbufStealPush(ringbuf_steal_t pool, unsigned worker, void *job);
+
+/*
+ * Take the most recently queued job from worker's own ring. Only
+ * worker's owner may call this.
+ *
+ * Returns the job, or 0 if the ring is empty.
+ */
+void *ringbufStealPop(ringbuf_steal_t pool, unsigned worker);
+
+/*
+ * Steal up to max of the oldest jobs from victim's ring, but never
+ * more than half of them (rounded up), and queue them on thief's own
+ * ring, oldest first. Only thief's owner may call this.
+ *
+ * A batch is stolen one job at a time, so concurrent thieves and the
+ * victim's owner can interleave with it; it stops early when the
+ * victim runs dry, another thread wins a race, or thief's ring fills
+ * up. Returns the number of jobs stolen.
+ */
+size_t ringbufStealBatch(ringbuf_steal_t pool, unsigned thief,
+                         unsigned victim, size_t max);
+
+/*
+ * The worker loop's "what next" call: pop a job from worker's own
+ * ring or, if it is empty, steal a batch from the other rings in
+ * round-robin order (starting after worker) and pop from that.
+ *
+ * Returns a job, or 0 if no job could be found anywhere.
+ */
+void *ringbufStealNext(ringbuf_steal_t pool, unsigned worker);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* INCLUDED_RINGBUF_STEAL_H */
@@ -13,6 +13,12 @@
  * <http://creativecommons.org/publicdomain/zero/1.0/>.
  */
 
+#ifdef __linux__
+#define _GNU_SOURCE     /* F_SETPIPE_SZ, sched_setaffinity */
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
 #include <string.h>
 #include <unistd.h>
 #include <stdio.h>
@@ -20,7 +26,19 @@
 #include <stdint.h>
 #include <signal.h>
 #include <assert.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <pthread.h>
+#include <sched.h>
 #include "ringbuf.h"
+#include "ringbuf-direct.h"
+#include "ringbuf-log.h"
+#include "ringbuf-percpu.h"
+#include "ringbuf-steal.h"
+#include "ringbuf-uring.h"
 
 /*
  * Fill a buffer with a test pattern.
@@ -64,6 +82,154 @@ sigabort(int unused)
     exit(1);
 }
 
+/*
+ * Work-stealing stress test: worker 0 produces every job, and all
+ * workers (including 0) run them; each job must run exactly once.
+ */
+#define STEAL_WORKERS 4
+#define STEAL_JOBS 200000
+
+ringbuf_steal_t steal_pool;
+unsigned steal_runs[STEAL_JOBS];
+unsigned steal_done;
+
+struct steal_worker
+{
+    pthread_t thread;
+    unsigned id;
+};
+
+void *
+steal_worker_main(void *arg)
+{
+    unsigned id = ((struct steal_worker *) arg)->id;
+    size_t next = 0;
+    while (__atomic_load_n(&steal_done, __ATOMIC_ACQUIRE) != STEAL_JOBS) {
+        while (id == 0 && next != STEAL_JOBS &&
+               ringbufStealPush(steal_pool, 0, &steal_runs[next]) == 0)
+            ++next;
+        unsigned *job = ringbufStealNext(steal_pool, id);
+        if (job) {
+            __atomic_fetch_add(job, 1, __ATOMIC_RELAXED);
+            __atomic_fetch_add(&steal_done, 1, __ATOMIC_RELEASE);
+        }
+    }
+    return 0;
+}
+
+/*
+ * Per-CPU ring stress test: more producer threads than CPUs, so
+ * reservations get preempted (and, with more than one CPU, migrated)
+ * mid-sequence; every record must arrive exactly once and intact.
+ */
+#define PERCPU_THREADS 8
+#define PERCPU_RECORDS 20000
+
+ringbuf_percpu_t percpu;
+uint8_t percpu_seen[PERCPU_THREADS][PERCPU_RECORDS];
+size_t percpu_received;
+
+struct percpu_rec
+{
+    uint32_t thread, seq;
+    uint8_t fill[64];
+};
+
+void *
+percpu_producer(void *arg)
+{
+    uint32_t id = (uint32_t) (uintptr_t) arg;
+    struct percpu_rec rec;
+    rec.thread = id;
+    for (uint32_t seq = 0; seq != PERCPU_RECORDS; ++seq) {
+        size_t nfill = seq % sizeof(rec.fill);
+        rec.seq = seq;
+        memset(rec.fill, (id + seq) & 0xff, nfill);
+        while (ringbufPercpuAppend(percpu, seq, &rec, 8 + nfill) != 0)
+            sched_yield();
+    }
+    return 0;
+}
+
+void
+percpu_consume(void *arg, uint64_t key, const void *data, size_t len)
+{
+    struct percpu_rec rec;
+    (void) arg;
+    assert(len >= 8 && len <= sizeof(rec));
+    memcpy(&rec, data, len);
+    assert(rec.thread < PERCPU_THREADS && rec.seq == key);
+    assert(len == 8 + rec.seq % sizeof(rec.fill));
+    for (size_t i = 0; i != len - 8; ++i)
+        assert(rec.fill[i] == ((rec.thread + rec.seq) & 0xff));
+    assert(!percpu_seen[rec.thread][rec.seq]);
+    percpu_seen[rec.thread][rec.seq] = 1;
+    ++percpu_received;
+}
+
+/*
+ * A record whose data faults part-way through the producer's copy,
+ * so the consumer can drain while the reservation is stalled.
+ */
+void *percpu_stall_page;
+size_t percpu_stall_drained;
+uint64_t percpu_stall_key;
+
+void
+percpu_stall_consume(void *arg, uint64_t key, const void *data, size_t len)
+{
+    (void) arg;
+    (void) data;
+    (void) len;
+    percpu_stall_key = key;
+}
+
+void
+percpu_stall_handler(int sig)
+{
+    (void) sig;
+    percpu_stall_drained = ringbufPercpuDrain(percpu, percpu_stall_consume, 0);
+    mprotect(percpu_stall_page, sysconf(_SC_PAGESIZE), PROT_READ);
+}
+
+/*
+ * Asynchronous logging test: several threads log through their own
+ * rings, and every message must come out formatted, in order per
+ * thread.
+ */
+#define LOG_THREADS 4
+#define LOG_MESSAGES 5000
+
+ringbuf_log_t test_log;
+int test_log_fmt;
+
+void *
+log_producer(void *arg)
+{
+    int id = (int) (uintptr_t) arg;
+    for (unsigned i = 0; i != LOG_MESSAGES; ++i)
+        assert(ringbufLog(test_log, test_log_fmt, id, i, "abc" + i % 4,
+                          (unsigned long) i * 3, i / 4.0) == 0);
+    return 0;
+}
+
+/*
+ * A ringbufTransform callback that counts its calls in seen[0], and
+ * records each segment's length in seen[1] and seen[2], and the second
+ * one's offset in the range in seen[3].
+ */
+void
+record_segment(uint8_t *p, size_t n, size_t pos, void *arg)
+{
+    size_t *seen = arg;
+    (void) p;
+    if (seen[0] < 2)
+        seen[1 + seen[0]] = n;
+    if (seen[0] == 1)
+        seen[3] = pos;
+    ++seen[0];
+}
+
 #define START_NEW_TEST(test_num) \
     fprintf(stderr, "Test %d...", (++test_num));
 
@@ -2195,6 +2361,1408 @@ main(int argc, char **argv)
     assert(ringbufFindchr(rb1, 'd', 1) == ringbufBytesUsed(rb1));
     END_TEST(test_num);
     
+#ifdef __linux__
+    int pipefd[2];
+    assert(pipe(pipefd) == 0);
+
+    /* ringbufSpliceOut, readable data wraps */
+    START_NEW_TEST(test_num);
+    ringbufReset(rb1);
+    ringbufMemset(rb1, 1, ringbufBufferSize(rb1));
+    ringbufReset(rb1);
+    assert(ftruncate(wrfd, 0) == 0);
+    assert(lseek(wrfd, 0, SEEK_SET) == 0);
+    ringbufMemcpyInto(rb1, buf, RINGBUF_SIZE - 16);
+    assert(ringbufMemcpyFrom(dst, rb1, RINGBUF_SIZE - 32) == ringbufTail(rb1));
+    ringbufMemcpyInto(rb1, buf + RINGBUF_SIZE - 16, 32);
+    assert(ringbufBytesUsed(rb1) == 48);
+    assert(ringbufSpliceOut(wrfd, pipefd, rb1, 49) == 0);
+    assert(ringbufBytesUsed(rb1) == 48);
+    assert(ringbufSpliceOut(wrfd, pipefd, rb1, 48) == 48);
+    assert(ringbufIsEmpty(rb1));
+    assert(ringbufTail(rb1) == rb1_base + 16);
+    assert(lseek(wrfd, 0, SEEK_SET) == 0);
+    assert(read(wrfd, dst, RINGBUF_SIZE) == 48);
+    assert(memcmp(dst, buf + RINGBUF_SIZE - 32, 48) == 0);
+    END_TEST(test_num);
+
+    /* ringbufSpliceIn, free space wraps */
+    START_NEW_TEST(test_num);
+    ringbufReset(rb1);
+    ringbufMemset(rb1, 1, ringbufBufferSize(rb1));
+    ringbufReset(rb1);
+    assert(lseek(rdfd, 0, SEEK_SET) == 0);
+    ringbufMemcpyInto(rb1, buf, RINGBUF_SIZE - 16);
+    assert(ringbufMemcpyFrom(dst, rb1, RINGBUF_SIZE - 32) == ringbufTail(rb1));
+    assert(ringbufSpliceIn(rdfd, pipefd, rb1, 64) == 64);
+    assert(ringbufBytesUsed(rb1) == 80);
+    assert(ringbufHead(rb1) == rb1_base + 48);
+    assert(ringbufMemcpyFrom(dst, rb1, 80) == ringbufTail(rb1));
+    assert(memcmp(dst, buf + RINGBUF_SIZE - 32, 16) == 0);
+    assert(memcmp(dst + 16, buf, 64) == 0);
+    END_TEST(test_num);
+
+    /* ringbufSpliceIn never overflows */
+    START_NEW_TEST(test_num);
+    ringbufReset(rb1);
+    assert(lseek(rdfd, 0, SEEK_SET) == 0);
+    ringbufMemcpyInto(rb1, buf, RINGBUF_SIZE - 8);
+    assert(ringbufSpliceIn(rdfd, pipefd, rb1, RINGBUF_SIZE) == 7);
+    assert(ringbufIsFull(rb1));
+    assert(ringbufTail(rb1) == rb1_base);
+    assert(ringbufSpliceIn(rdfd, pipefd, rb1, RINGBUF_SIZE) == 0);
+    END_TEST(test_num);
+
+    /* ringbufSpliceIn moves bytes left in the pipe before reading more */
+    START_NEW_TEST(test_num);
+    ringbufReset(rb1);
+    assert(lseek(rdfd, 0, SEEK_SET) == 0);
+    assert(write(pipefd[1], "left", 4) == 4);
+    assert(ringbufSpliceIn(rdfd, pipefd, rb1, 2) == 2);
+    assert(ringbufSpliceIn(rdfd, pipefd, rb1, 64) == 2);
+    assert(ringbufSpliceIn(rdfd, pipefd, rb1, 64) == 64);
+    assert(ringbufMemcpyFrom(dst, rb1, 68) == ringbufTail(rb1));
+    assert(memcmp(dst, "left", 4) == 0);
+    assert(memcmp(dst + 4, buf, 64) == 0);
+    END_TEST(test_num);
+
+    close(pipefd[0]);
+    close(pipefd[1]);
+#endif /* __linux__ */
+
+#ifdef __linux__
+    int sv[2];
+    assert(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == 0);
+    struct ringbuf_uring_done done[4];
+    ringbuf_uring_t u = ringbufUringNew(8);
+
+    /*
+     * io_uring may be disabled (e.g., by seccomp or
+     * kernel.io_uring_disabled); skip these tests if so.
+     */
+    if (u) {
+        /* one submission carries a wrapped writev and a wrapped readv */
+        START_NEW_TEST(test_num);
+        ringbufReset(rb1);
+        ringbufReset(rb2);
+        ringbufMemcpyInto(rb1, buf, RINGBUF_SIZE - 16);
+        assert(ringbufMemcpyFrom(dst, rb1, RINGBUF_SIZE - 32) == ringbufTail(rb1));
+        ringbufMemcpyInto(rb1, buf + RINGBUF_SIZE - 16, 32);
+        ringbufMemcpyInto(rb2, buf, RINGBUF_SIZE - 24);
+        assert(ringbufMemcpyFrom(dst, rb2, RINGBUF_SIZE - 24) == ringbufTail(rb2));
+        assert(ringbufUringPrepWrite(u, sv[0], rb1, 48, -1) == 0);
+        assert(ringbufUringPrepRead(u, sv[1], rb2, 48, -1) == 0);
+        assert(ringbufUringSubmit(u, 2) == 2);
+        assert(ringbufUringReap(u, done, 4) == 2);
+        assert(done[0].res == 48 && done[1].res == 48);
+        assert(ringbufIsEmpty(rb1));
+        assert(ringbufBytesUsed(rb2) == 48);
+        assert(ringbufHead(rb2) ==
+               (const uint8_t *) ringbufTail(rb2) + 48 - RINGBUF_SIZE);
+        assert(ringbufMemcpyFrom(dst, rb2, 48) == ringbufTail(rb2));
+        assert(memcmp(dst, buf + RINGBUF_SIZE - 32, 48) == 0);
+        assert(ringbufUringReap(u, done, 4) == 0);
+        /* nothing to write, or no room to read into: nothing queued */
+        errno = 0;
+        assert(ringbufUringPrepWrite(u, sv[0], rb1, 48, -1) == -1);
+        assert(errno == EAGAIN);
+        ringbufMemset(rb2, 0, RINGBUF_SIZE - 1);
+        errno = 0;
+        assert(ringbufUringPrepRead(u, sv[1], rb2, 48, -1) == -1);
+        assert(errno == EAGAIN);
+        assert(ringbufUringSubmit(u, 0) == 0);
+        ringbufReset(rb2);
+        END_TEST(test_num);
+
+        /* fixed buffers cover the first contiguous segment only */
+        START_NEW_TEST(test_num);
+        ringbuf_t rings[2];
+        rings[0] = rb1;
+        rings[1] = rb2;
+        assert(ringbufUringRegister(u, rings, 2) == 0);
+        ringbufReset(rb1);
+        ringbufReset(rb2);
+        ringbufMemcpyInto(rb1, buf, RINGBUF_SIZE - 16);
+        assert(ringbufMemcpyFrom(dst, rb1, RINGBUF_SIZE - 32) == ringbufTail(rb1));
+        ringbufMemcpyInto(rb1, buf + RINGBUF_SIZE - 16, 32);
+        assert(ringbufUringPrepWrite(u, sv[0], rb1, 48, 0) == 0);
+        assert(ringbufUringPrepRead(u, sv[1], rb2, RINGBUF_SIZE, 1) == 0);
+        assert(ringbufUringSubmit(u, 2) == 2);
+        assert(ringbufUringReap(u, done, 4) == 2);
+        assert(done[0].rb == rb1 && done[0].write && done[0].res == 32);
+        assert(done[1].rb == rb2 && !done[1].write && done[1].res == 32);
+        assert(ringbufBytesUsed(rb1) == 16);
+        assert(ringbufTail(rb1) == rb1_base);
+        assert(ringbufMemcpyFrom(dst, rb2, 32) == ringbufTail(rb2));
+        assert(memcmp(dst, buf + RINGBUF_SIZE - 32, 32) == 0);
+        END_TEST(test_num);
+
+        ringbufUringFree(&u);
+        assert(!u);
+    }
+    close(sv[0]);
+    close(sv[1]);
+#endif /* __linux__ */
+
+#ifdef __linux__
+    /* MSG_ZEROCOPY over TCP loopback, if the kernel supports it */
+    int lsock = socket(AF_INET, SOCK_STREAM, 0);
+    assert(lsock != -1);
+    struct sockaddr_in sin;
+    socklen_t sinlen = sizeof(sin);
+    memset(&sin, 0, sizeof(sin));
+    sin.sin_family = AF_INET;
+    sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    int one = 1;
+    if (bind(lsock, (struct sockaddr *) &sin, sizeof(sin)) == 0 &&
+        listen(lsock, 1) == 0 &&
+        getsockname(lsock, (struct sockaddr *) &sin, &sinlen) == 0) {
+        int csock = socket(AF_INET, SOCK_STREAM, 0);
+        assert(csock != -1);
+        assert(connect(csock, (struct sockaddr *) &sin, sizeof(sin)) == 0);
+        int asock = accept(lsock, 0, 0);
+        assert(asock != -1);
+
+        if (setsockopt(csock, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof(one)) == 0) {
+            /* in-flight bytes stay in the ring until completion */
+            START_NEW_TEST(test_num);
+            ringbufReset(rb1);
+            ringbufMemcpyInto(rb1, buf, RINGBUF_SIZE - 16);
+            assert(ringbufMemcpyFrom(dst, rb1, RINGBUF_SIZE - 32) == ringbufTail(rb1));
+            ringbufMemcpyInto(rb1, buf + RINGBUF_SIZE - 16, 32);
+            assert(ringbufSendZerocopy(csock, rb1, 49) == 0);
+            assert(ringbufSendZerocopy(csock, rb1, 40) == 40);
+            assert(ringbufBytesInflight(rb1) == 40);
+            /* nothing else releases or overwrites the pinned bytes */
+            assert(ringbufMemcpyFrom(dst, rb1, 8) == 0);
+            assert(ringbufMemcpyInto(rb1, buf, RINGBUF_SIZE) == 0);
+            assert(ringbufAck(rb1, 40) == 0);
+            assert(ringbufRewind(rb1) == 0);
+            assert(ringbufBytesInflight(rb1) == 40);
+            assert(ringbufBytesUsed(rb1) == 48);
+            assert(ringbufTail(rb1) == rb1_base + RINGBUF_SIZE - 32);
+            assert(ringbufSendZerocopy(csock, rb1, 9) == 0);
+            assert(ringbufSendZerocopy(csock, rb1, 8) == 8);
+            assert(ringbufBytesInflight(rb1) == 48);
+            assert(read(asock, dst, RINGBUF_SIZE) == 48);
+            assert(memcmp(dst, buf + RINGBUF_SIZE - 32, 48) == 0);
+            int nreaped = 0;
+            while (nreaped != 48) {
+                ssize_t r = ringbufZerocopyReap(csock, rb1);
+                assert(r >= 0);
+                nreaped += r;
+                if (r == 0)
+                    usleep(1000);
+            }
+            assert(ringbufIsEmpty(rb1));
+            assert(ringbufBytesInflight(rb1) == 0);
+            assert(ringbufTail(rb1) == rb1_base + 16);
+            END_TEST(test_num);
+        }
+        close(asock);
+        close(csock);
+    }
+    close(lsock);
+#endif /* __linux__ */
+
+    /* record mode: records never straddle the wrap */
+    START_NEW_TEST(test_num);
+    {
+        ringbuf_t rrb = ringbufNew(600);
+        const void *data;
+        const struct sockaddr *addr;
+        socklen_t addrlen;
+        struct sockaddr_in rsin;
+        memset(&rsin, 0, sizeof(rsin));
+        rsin.sin_family = AF_INET;
+        rsin.sin_port = htons(4242);
+        assert(ringbufRecordPeek(rrb, &data, &addr, &addrlen) == -1);
+        assert(ringbufRecordPop(rrb) == -1);
+        assert(ringbufRecordPut(rrb, "record 1", 8, 0, 0) == 0);
+        assert(ringbufRecordPut(rrb, "record two", 10,
+                                (struct sockaddr *) &rsin, sizeof(rsin)) == 0);
+        assert(ringbufRecordPut(rrb, "3", 1, 0, 0) == 0);
+        assert(ringbufRecordPut(rrb, "no room for me", 14, 0, 0) == -1);
+        assert(ringbufRecordPeek(rrb, &data, &addr, &addrlen) == 8);
+        assert(memcmp(data, "record 1", 8) == 0);
+        assert(addr == 0 && addrlen == 0);
+        assert(ringbufRecordPop(rrb) == 0);
+        assert(ringbufRecordPeek(rrb, &data, &addr, &addrlen) == 10);
+        assert(memcmp(data, "record two", 10) == 0);
+        assert(addrlen == sizeof(rsin));
+        assert(((const struct sockaddr_in *) addr)->sin_port == htons(4242));
+        assert(ringbufRecordPop(rrb) == 0);
+        /* this one wraps to the start of the buffer */
+        assert(ringbufRecordPut(rrb, "wrapped", 7, 0, 0) == 0);
+        assert(ringbufHead(rrb) < ringbufTail(rrb));
+        assert(ringbufRecordPeek(rrb, &data, 0, 0) == 1);
+        assert(memcmp(data, "3", 1) == 0);
+        assert(ringbufRecordPop(rrb) == 0);
+        assert(ringbufRecordPeek(rrb, &data, 0, 0) == 7);
+        assert(memcmp(data, "wrapped", 7) == 0);
+        assert(ringbufRecordPop(rrb) == 0);
+        assert(ringbufIsEmpty(rrb));
+        assert(ringbufRecordPop(rrb) == -1);
+        ringbufFree(&rrb);
+    }
+    END_TEST(test_num);
+
+#ifdef __linux__
+    /* ringbufSendmmsg/ringbufRecvmmsg over UDP loopback */
+    START_NEW_TEST(test_num);
+    {
+        ringbuf_t txrb = ringbufNew(1024);
+        ringbuf_t rxrb = ringbufNew(1024);
+        int txsock = socket(AF_INET, SOCK_DGRAM, 0);
+        int rxsock = socket(AF_INET, SOCK_DGRAM, 0);
+        struct sockaddr_in txsin, rxsin;
+        socklen_t len = sizeof(txsin);
+        const void *data;
+        const struct sockaddr *addr;
+        socklen_t addrlen;
+        assert(txsock != -1 && rxsock != -1);
+        memset(&txsin, 0, sizeof(txsin));
+        txsin.sin_family = AF_INET;
+        txsin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        rxsin = txsin;
+        assert(bind(txsock, (struct sockaddr *) &txsin, sizeof(txsin)) == 0);
+        assert(getsockname(txsock, (struct sockaddr *) &txsin, &len) == 0);
+        assert(bind(rxsock, (struct sockaddr *) &rxsin, sizeof(rxsin)) == 0);
+        assert(getsockname(rxsock, (struct sockaddr *) &rxsin, &len) == 0);
+
+        assert(ringbufSendmmsg(txsock, txrb, 8) == 0);
+        assert(ringbufRecordPut(txrb, "alpha", 5,
+                                (struct sockaddr *) &rxsin, sizeof(rxsin)) == 0);
+        assert(ringbufRecordPut(txrb, "beta", 4,
+                                (struct sockaddr *) &rxsin, sizeof(rxsin)) == 0);
+        assert(ringbufRecordPut(txrb, "gamma", 5,
+                                (struct sockaddr *) &rxsin, sizeof(rxsin)) == 0);
+        assert(ringbufSendmmsg(txsock, txrb, 8) == 3);
+        assert(ringbufIsEmpty(txrb));
+
+        /* 4 slots of 64 bytes fit; the last one isn't filled */
+        assert(ringbufRecvmmsg(rxsock, rxrb, 64, 4) == 3);
+        assert(ringbufRecordPeek(rxrb, &data, &addr, &addrlen) == 5);
+        assert(memcmp(data, "alpha", 5) == 0);
+        assert(addrlen == sizeof(txsin));
+        assert(((const struct sockaddr_in *) addr)->sin_port == txsin.sin_port);
+        assert(ringbufRecordPop(rxrb) == 0);
+        assert(ringbufRecordPeek(rxrb, &data, 0, 0) == 4);
+        assert(memcmp(data, "beta", 4) == 0);
+        assert(ringbufRecordPop(rxrb) == 0);
+        assert(ringbufRecordPeek(rxrb, &data, 0, 0) == 5);
+        assert(memcmp(data, "gamma", 5) == 0);
+        assert(ringbufRecordPop(rxrb) == 0);
+        assert(ringbufIsEmpty(rxrb));
+
+        close(txsock);
+        close(rxsock);
+        ringbufFree(&txrb);
+        ringbufFree(&rxrb);
+    }
+    END_TEST(test_num);
+#endif /* __linux__ */
+
+    /* three cursors: head, send cursor and acknowledgement cursor */
+    START_NEW_TEST(test_num);
+    {
+        struct iovec iov[2];
+        ringbufReset(rb1);
+        ringbufMemcpyInto(rb1, buf, RINGBUF_SIZE - 16);
+        assert(ringbufMemcpyFrom(dst, rb1, RINGBUF_SIZE - 32) == ringbufTail(rb1));
+        ringbufMemcpyInto(rb1, buf + RINGBUF_SIZE - 16, 32);
+        assert(ringbufPeekUnsent(rb1, 100, iov) == 2);
+        assert(iov[0].iov_base == rb1_base + RINGBUF_SIZE - 32);
+        assert(iov[0].iov_len == 32 && iov[1].iov_len == 16);
+        ringbufMarkSent(rb1, 20);
+        assert(ringbufBytesInflight(rb1) == 20);
+        assert(ringbufPeekUnsent(rb1, 100, iov) == 2);
+        assert(iov[0].iov_base == rb1_base + RINGBUF_SIZE - 12);
+        assert(iov[0].iov_len == 12 && iov[1].iov_len == 16);
+        ringbufMarkSent(rb1, 20);
+        assert(ringbufPeekUnsent(rb1, 100, iov) == 1);
+        assert(iov[0].iov_base == rb1_base + 8 && iov[0].iov_len == 8);
+        /* resend an unacknowledged range that wraps */
+        assert(ringbufPeekRange(rb1, 30, 4, iov) == 2);
+        assert(iov[0].iov_base == rb1_base + RINGBUF_SIZE - 2);
+        assert(iov[0].iov_len == 2 && iov[1].iov_base == rb1_base);
+        assert(iov[1].iov_len == 2);
+        assert(ringbufPeekRange(rb1, 40, 9, iov) == -1);
+        /* acknowledgements never release unsent bytes */
+        assert(ringbufAck(rb1, 10) == 10);
+        assert(ringbufBytesInflight(rb1) == 30);
+        assert(ringbufBytesUsed(rb1) == 38);
+        assert(ringbufAck(rb1, 100) == 30);
+        assert(ringbufBytesInflight(rb1) == 0);
+        assert(ringbufBytesUsed(rb1) == 8);
+        assert(ringbufTail(rb1) == rb1_base + 8);
+        /* consuming from the tail waits until in-flight bytes are acked */
+        ringbufMarkSent(rb1, 6);
+        assert(ringbufMemcpyFrom(dst, rb1, 2) == 0);
+        assert(ringbufBytesUsed(rb1) == 8);
+        assert(ringbufBytesInflight(rb1) == 6);
+        assert(ringbufAck(rb1, 6) == 6);
+        assert(ringbufMemcpyFrom(dst, rb1, 2) == ringbufTail(rb1));
+        assert(ringbufIsEmpty(rb1));
+
+        /* overflowing never overwrites in-flight bytes */
+        ringbuf_t rb16 = ringbufNew(16);
+        int p[2];
+        assert(pipe(p) == 0);
+        ringbufMemcpyInto(rb16, buf, 10);
+        ringbufMarkSent(rb16, 10);
+        assert(ringbufMemcpyInto(rb16, buf + 10, 16) == 0);
+        assert(ringbufMemset(rb16, 0, 16) == 0);
+        assert(ringbufBytesUsed(rb16) == 10);
+        assert(write(p[1], buf + 100, 16) == 16);
+        assert(ringbufRead(p[0], rb16, 16) == 6);
+        errno = 0;
+        assert(ringbufRead(p[0], rb16, 10) == -1 && errno == ENOBUFS);
+        assert(ringbufBytesUsed(rb16) == 16);
+        assert(ringbufBytesInflight(rb16) == 10);
+        assert(ringbufAck(rb16, 16) == 10);
+        assert(ringbufMemcpyFrom(dst, rb16, 6) == ringbufTail(rb16));
+        assert(memcmp(dst, buf + 100, 6) == 0);
+        /* nothing in flight: overflow as usual */
+        ringbufMemcpyInto(rb16, buf, 20);
+        assert(ringbufIsFull(rb16));
+        assert(ringbufMemcpyFrom(dst, rb16, 16) == ringbufTail(rb16));
+        assert(memcmp(dst, buf + 4, 16) == 0);
+        close(p[0]);
+        close(p[1]);
+        ringbufFree(&rb16);
+    }
+    END_TEST(test_num);
+
+    /* transactional writes: head only moves on commit */
+    START_NEW_TEST(test_num);
+    {
+        struct iovec iov[2];
+        ringbufReset(rb1);
+        ringbufMemcpyInto(rb1, buf, RINGBUF_SIZE - 16);
+        assert(ringbufMemcpyFrom(dst, rb1, RINGBUF_SIZE - 20) == ringbufTail(rb1));
+        ringbufTxnBegin(rb1);
+        assert(ringbufTxnAppend(rb1, "header", 6) == 0);
+        assert(ringbufHead(rb1) == rb1_base + RINGBUF_SIZE - 16);
+        assert(ringbufBytesUsed(rb1) == 4);
+        /* the body wraps; encode part of it in place */
+        assert(ringbufTxnReserve(rb1, 14, iov) == 2);
+        assert(iov[0].iov_base == rb1_base + RINGBUF_SIZE - 10);
+        assert(iov[0].iov_len == 10 && iov[1].iov_base == rb1_base);
+        assert(iov[1].iov_len == 4);
+        memcpy(iov[0].iov_base, "body: 0123", 10);
+        memcpy(iov[1].iov_base, "4567", 4);
+        ringbufTxnAdvance(rb1, 14);
+        assert(ringbufBytesUsed(rb1) == 4);
+        assert(ringbufTxnCommit(rb1) == 20);
+        assert(ringbufHead(rb1) == rb1_base + 4);
+        assert(ringbufBytesUsed(rb1) == 24);
+        assert(ringbufMemcpyFrom(dst, rb1, 24) == ringbufTail(rb1));
+        assert(memcmp(dst + 4, "headerbody: 01234567", 20) == 0);
+        /* an abort leaves no trace */
+        ringbufTxnBegin(rb1);
+        assert(ringbufTxnAppend(rb1, "partial", 7) == 0);
+        assert(ringbufTxnAppend(rb1, buf, ringbufCapacity(rb1)) == -1);
+        ringbufTxnAbort(rb1);
+        assert(ringbufTxnCommit(rb1) == 0);
+        assert(ringbufIsEmpty(rb1));
+        assert(ringbufHead(rb1) == rb1_base + 4);
+    }
+    END_TEST(test_num);
+
+    /* two-phase consumption: read, fail, rewind, reread, release */
+    START_NEW_TEST(test_num);
+    {
+        struct iovec iov[2];
+        ringbufReset(rb1);
+        ringbufMemcpyInto(rb1, buf, RINGBUF_SIZE - 16);
+        assert(ringbufMemcpyFrom(dst, rb1, RINGBUF_SIZE - 24) == ringbufTail(rb1));
+        ringbufMemcpyInto(rb1, buf + RINGBUF_SIZE - 16, 24);
+        assert(ringbufBytesUsed(rb1) == 32);
+        assert(ringbufMemcpyFromHold(dst, rb1, 33) == 0);
+        assert(ringbufMemcpyFromHold(dst, rb1, 20) == rb1_base + RINGBUF_SIZE - 4);
+        assert(memcmp(dst, buf + RINGBUF_SIZE - 24, 20) == 0);
+        assert(ringbufBytesUsed(rb1) == 32);
+        assert(ringbufTail(rb1) == rb1_base + RINGBUF_SIZE - 24);
+        assert(ringbufRewind(rb1) == 20);
+        assert(ringbufPeekUnsent(rb1, 20, iov) == 1);
+        assert(iov[0].iov_base == rb1_base + RINGBUF_SIZE - 24);
+        ringbufMarkSent(rb1, 20);
+        assert(ringbufRelease(rb1) == 20);
+        assert(ringbufBytesUsed(rb1) == 12);
+        assert(ringbufTail(rb1) == rb1_base + RINGBUF_SIZE - 4);
+        assert(ringbufRewind(rb1) == 0);
+        assert(ringbufMemcpyFromHold(dst, rb1, 12) == rb1_base + 8);
+        assert(memcmp(dst, buf + RINGBUF_SIZE - 4, 12) == 0);
+        assert(ringbufRelease(rb1) == 12);
+        assert(ringbufIsEmpty(rb1));
+    }
+    END_TEST(test_num);
+
+    /* ringbufMove swaps buffers when src is drained into an empty dst */
+    START_NEW_TEST(test_num);
+    ringbufReset(rb1);
+    ringbufReset(rb2);
+    {
+        const uint8_t *end1 = ringbufEnd(rb1), *end2 = ringbufEnd(rb2);
+        ringbufMemcpyInto(rb1, buf, RINGBUF_SIZE - 8);
+        ringbufMemcpyFrom(dst, rb1, RINGBUF_SIZE - 16);
+        ringbufMemcpyInto(rb1, buf, 16);
+        const uint8_t *tail = ringbufTail(rb1);
+        assert(ringbufMove(rb2, rb1, 24) == ringbufHead(rb2));
+        assert(ringbufEnd(rb2) == end1 && ringbufEnd(rb1) == end2);
+        assert(ringbufTail(rb2) == tail);
+        assert(ringbufBytesUsed(rb2) == 24);
+        assert(ringbufIsEmpty(rb1));
+        assert(ringbufHead(rb1) == end2 - RINGBUF_SIZE);
+        ringbufMemcpyFrom(dst, rb2, 24);
+        assert(memcmp(dst, buf + RINGBUF_SIZE - 16, 8) == 0);
+        assert(memcmp(dst + 8, buf, 16) == 0);
+
+        /* swap back so rb1_base stays valid for later tests */
+        ringbufMemcpyInto(rb2, buf, 4);
+        assert(ringbufMove(rb1, rb2, 4) == ringbufHead(rb1));
+        assert(ringbufEnd(rb1) == end1 && ringbufEnd(rb2) == end2);
+
+        /* partial moves and non-empty dst copy instead; held bytes stay */
+        assert(ringbufMove(rb2, rb1, 2) == ringbufHead(rb2));
+        assert(ringbufEnd(rb2) == end2);
+        assert(ringbufMove(rb2, rb1, 2) == ringbufHead(rb2));
+        assert(ringbufEnd(rb2) == end2 && ringbufBytesUsed(rb2) == 4);
+        ringbufMemcpyFrom(dst, rb2, 4);
+        assert(memcmp(dst, buf, 4) == 0);
+        ringbufMemcpyInto(rb1, buf, 8);
+        assert(ringbufMemcpyFromHold(dst, rb1, 4) != 0);
+        assert(ringbufMove(rb2, rb1, 8) == 0);
+        assert(ringbufRelease(rb1) == 4);
+        assert(ringbufMove(rb2, rb1, 4) == ringbufHead(rb2));
+        assert(ringbufBytesUsed(rb2) == 4);
+        assert(ringbufIsEmpty(rb1) && ringbufBytesInflight(rb1) == 0);
+        assert(ringbufMove(rb2, rb1, 1) == 0);
+    }
+    END_TEST(test_num);
+
+    /* ringbufWritevMany drains several rings with one writev */
+    START_NEW_TEST(test_num);
+    ringbufReset(rb1);
+    ringbufReset(rb2);
+    {
+        int pfd[2];
+        assert(pipe(pfd) == 0);
+        ringbuf_t rb3 = ringbufNew(16);
+        ringbuf_t rings[3] = {rb1, rb3, rb2};
+        ringbufMemcpyInto(rb1, buf, 10);
+        ringbufMemcpyInto(rb3, buf, 12);
+        ringbufMemcpyFrom(dst, rb3, 12);
+        ringbufMemcpyInto(rb3, buf + 100, 8);    /* wraps */
+        assert(ringbufWritevMany(pfd[1], rings + 2, 1) == 0);
+        assert(ringbufWritevMany(pfd[1], rings, 3) == 18);
+        assert(ringbufIsEmpty(rb1) && ringbufIsEmpty(rb3));
+        assert(read(pfd[0], dst, 18) == 18);
+        assert(memcmp(dst, buf, 10) == 0);
+        assert(memcmp(dst + 10, buf + 100, 8) == 0);
+
+        /* a ring with bytes in flight is skipped until they're acked */
+        ringbuf_t sent = ringbufNew(16);
+        ringbuf_t mixed[3] = {rb1, sent, rb3};
+        ringbufMemcpyInto(rb1, buf, 5);
+        ringbufMemcpyInto(sent, buf + 50, 6);
+        ringbufMarkSent(sent, 4);
+        ringbufMemcpyInto(rb3, buf + 60, 3);
+        assert(ringbufWritevMany(pfd[1], mixed, 3) == 8);
+        assert(ringbufBytesUsed(sent) == 6 && ringbufBytesInflight(sent) == 4);
+        assert(ringbufWritevMany(pfd[1], mixed, 3) == 0);
+        assert(ringbufAck(sent, 4) == 4);
+        assert(ringbufWritevMany(pfd[1], mixed, 3) == 2);
+        assert(ringbufIsEmpty(sent));
+        assert(read(pfd[0], dst, 10) == 10);
+        assert(memcmp(dst, buf, 5) == 0);
+        assert(memcmp(dst + 5, buf + 60, 3) == 0);
+        assert(memcmp(dst + 8, buf + 54, 2) == 0);
+        ringbufFree(&sent);
+
+        /* a short write leaves the rest queued, in order */
+        fcntl(pfd[1], F_SETPIPE_SZ, 4096);
+        fcntl(pfd[1], F_SETFL, O_NONBLOCK);
+        ringbufMemcpyInto(rb1, buf, RINGBUF_SIZE - 1);
+        ringbufMemcpyInto(rb2, buf2, RINGBUF_SIZE - 1);
+        ssize_t w = ringbufWritevMany(pfd[1], rings, 3);
+        assert(w > RINGBUF_SIZE - 1 && w < 2 * (RINGBUF_SIZE - 1));
+        assert(ringbufIsEmpty(rb1));
+        assert(ringbufBytesUsed(rb2) == 2 * (RINGBUF_SIZE - 1) - (size_t) w);
+        assert(*(const uint8_t *) ringbufTail(rb2) == buf2[w - (RINGBUF_SIZE - 1)]);
+        assert(read(pfd[0], dst, w) == w);
+        assert(memcmp(dst, buf, RINGBUF_SIZE - 1) == 0);
+        assert(memcmp(dst + RINGBUF_SIZE - 1, buf2, w - (RINGBUF_SIZE - 1)) == 0);
+        ringbufReset(rb2);
+        ringbufFree(&rb3);
+        close(pfd[0]);
+        close(pfd[1]);
+    }
+    END_TEST(test_num);
+
+    /* ring groups flag empty -> non-empty transitions in a bitmap */
+    START_NEW_TEST(test_num);
+    ringbufReset(rb1);
+    ringbufReset(rb2);
+    {
+        ringbuf_t rings[200], ready[200];
+        ringbuf_group_t g = ringbufGroupNew(200);
+        assert(g);
+        for (int i = 0; i != 200; ++i) {
+            rings[i] = ringbufNew(64);
+            assert(ringbufGroupAdd(g, rings[i]) == i);
+        }
+        assert(ringbufGroupAdd(g, rb1) == -1);
+        assert(ringbufGroupPoll(g, ready, 200) == 0);
+
+        ringbufMemcpyInto(rings[3], buf, 8);
+        ringbufMemcpyInto(rings[3], buf, 8);
+        ringbufMemset(rings[64], 'x', 4);
+        assert(ringbufRead(rdfd, rings[130], 10) == 10);
+        ringbufAdvanceHead(rings[199], 1);
+        ringbufTxnBegin(rings[70]);
+        assert(ringbufTxnAppend(rings[70], buf, 4) == 0);
+        assert(ringbufGroupPoll(g, ready, 200) == 4);
+        assert(ready[0] == rings[3] && ready[1] == rings[64]);
+        assert(ready[2] == rings[130] && ready[3] == rings[199]);
+
+        /*
+         * no new bit while a ring isn't empty, so a ring stays ready
+         * until a poll finds it empty
+         */
+        ringbufReset(rings[64]);
+        ringbufReset(rings[130]);
+        ringbufReset(rings[199]);
+        ringbufMemcpyInto(rings[3], buf, 8);
+        ringbufMemcpyFrom(dst, rings[3], 16);
+        ringbufTxnCommit(rings[70]);
+        assert(ringbufGroupPoll(g, ready, 200) == 5);
+        assert(ready[0] == rings[3] && ready[2] == rings[70]);
+        assert(ringbufGroupPoll(g, ready, 200) == 2);
+        assert(ready[0] == rings[3] && ready[1] == rings[70]);
+        ringbufMemcpyFrom(dst, rings[3], 8);
+        ringbufMemcpyFrom(dst, rings[70], 4);
+        assert(ringbufGroupPoll(g, ready, 200) == 2);
+        assert(ringbufIsEmpty(ready[0]) && ringbufIsEmpty(ready[1]));
+        assert(ringbufGroupPoll(g, ready, 200) == 0);
+
+        /* polls resume where the last one stopped */
+        ringbufMemcpyInto(rings[3], buf, 1);
+        ringbufCopy(rings[5], rings[3], 1);
+        ringbufGroupMark(rings[64]);
+        assert(ringbufGroupPoll(g, ready, 2) == 2);
+        assert(ready[0] == rings[3] && ready[1] == rings[5]);
+        assert(ringbufGroupPoll(g, ready, 2) == 2);
+        assert(ready[0] == rings[64] && ready[1] == rings[5]);
+        ringbufMemcpyFrom(dst, rings[5], 1);
+        assert(ringbufGroupPoll(g, ready, 2) == 1 && ready[0] == rings[5]);
+        assert(ringbufGroupPoll(g, ready, 2) == 0);
+
+        /* membership */
+        ringbufGroupRemove(rings[10]);
+        ringbufGroupRemove(rings[20]);
+        assert(ringbufGroupAdd(g, rb1) == 20);
+        assert(ringbufGroupAdd(g, rb2) == 10);
+        assert(ringbufGroupAdd(g, rings[20]) == -1);
+        ringbufGroupRemove(rb2);
+        assert(ringbufGroupAdd(g, rings[20]) == 10);
+        ringbufMemcpyInto(rb1, buf, 1);
+        ringbufFree(&rings[199]);
+        assert(ringbufGroupPoll(g, ready, 200) == 1 && ready[0] == rb1);
+        ringbufGroupFree(&g);
+        assert(g == 0);
+        ringbufReset(rb1);
+        ringbufMemcpyInto(rb1, buf, 1);
+        for (int i = 0; i != 199; ++i)
+            ringbufFree(&rings[i]);
+        ringbufReset(rb1);
+    }
+    END_TEST(test_num);
+
+    /* work-stealing job rings */
+    START_NEW_TEST(test_num);
+    {
+        int jobs[8];
+        ringbuf_steal_t pool = ringbufStealNew(2, 3);
+        assert(pool && ringbufStealWorkers(pool) == 2);
+        assert(ringbufStealPop(pool, 0) == 0);
+        for (int i = 0; i != 4; ++i)
+            assert(ringbufStealPush(pool, 0, &jobs[i]) == 0);
+        assert(ringbufStealPush(pool, 0, &jobs[4]) == -1);
+
+        /* the owner pops LIFO, thieves take the oldest half */
+        assert(ringbufStealPop(pool, 0) == &jobs[3]);
+        assert(ringbufStealBatch(pool, 1, 0, 8) == 2);
+        assert(ringbufStealPop(pool, 1) == &jobs[1]);
+        assert(ringbufStealPop(pool, 1) == &jobs[0]);
+        assert(ringbufStealPop(pool, 1) == 0);
+        assert(ringbufStealNext(pool, 1) == &jobs[2]);
+        assert(ringbufStealNext(pool, 1) == 0);
+        assert(ringbufStealNext(pool, 0) == 0);
+        ringbufStealFree(&pool);
+        assert(pool == 0);
+
+        struct steal_worker workers[STEAL_WORKERS];
+        steal_pool = ringbufStealNew(STEAL_WORKERS, 256);
+        for (unsigned i = 0; i != STEAL_WORKERS; ++i) {
+            workers[i].id = i;
+            assert(pthread_create(&workers[i].thread, 0, steal_worker_main,
+                                  &workers[i]) == 0);
+        }
+        for (unsigned i = 0; i != STEAL_WORKERS; ++i)
+            pthread_join(workers[i].thread, 0);
+        for (unsigned i = 0; i != STEAL_JOBS; ++i)
+            assert(steal_runs[i] == 1);
+        ringbufStealFree(&steal_pool);
+    }
+    END_TEST(test_num);
+
+    /* per-CPU rings */
+    START_NEW_TEST(test_num);
+    {
+        cpu_set_t saved, one;
+        sched_getaffinity(0, sizeof(saved), &saved);
+        percpu = ringbufPercpuNew(100);
+        assert(percpu);
+
+        /* same CPU: ring order; records never fit, or fill the ring */
+        CPU_ZERO(&one);
+        CPU_SET(sched_getcpu(), &one);
+        sched_setaffinity(0, sizeof(one), &one);
+        assert(ringbufPercpuAppend(percpu, 0, buf, 113) == -1);
+        struct percpu_rec rec = {0, 5, {0}};
+        memset(rec.fill, 5, 5);
+        assert(ringbufPercpuAppend(percpu, 5, &rec, 8 + 5) == 0);
+        rec.seq = 3;
+        memset(rec.fill, 3, 3);
+        assert(ringbufPercpuAppend(percpu, 3, &rec, 8 + 3) == 0);
+        rec.seq = 40;
+        memset(rec.fill, 40, 40);
+        assert(ringbufPercpuAppend(percpu, 40, &rec, 8 + 40) == 0);
+        assert(ringbufPercpuAppend(percpu, 1, &rec, 8) == -1);
+        assert(ringbufPercpuDrain(percpu, percpu_consume, 0) == 3);
+        assert(percpu_seen[0][5] && percpu_seen[0][3] && percpu_seen[0][40]);
+        assert(ringbufPercpuDrain(percpu, percpu_consume, 0) == 0);
+
+        /*
+         * the next lap's headers land in the last lap's record data;
+         * a reservation stalled there must not look published
+         */
+        assert(ringbufPercpuAppend(percpu, 7, buf, 80) == 0);
+        assert(ringbufPercpuDrain(percpu, percpu_stall_consume, 0) == 1);
+        assert(percpu_stall_key == 7);
+        percpu_stall_page = mmap(0, sysconf(_SC_PAGESIZE), PROT_NONE,
+                                 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        assert(percpu_stall_page != MAP_FAILED);
+        struct sigaction stall, ostall;
+        memset(&stall, 0, sizeof(stall));
+        stall.sa_handler = percpu_stall_handler;
+        sigemptyset(&stall.sa_mask);
+        assert(sigaction(SIGSEGV, &stall, &ostall) == 0);
+        assert(ringbufPercpuAppend(percpu, 8, percpu_stall_page, 8) == 0);
+        assert(sigaction(SIGSEGV, &ostall, 0) == 0);
+        assert(percpu_stall_drained == 0);
+        assert(ringbufPercpuDrain(percpu, percpu_stall_consume, 0) == 1);
+        assert(percpu_stall_key == 8);
+        munmap(percpu_stall_page, sysconf(_SC_PAGESIZE));
+        sched_setaffinity(0, sizeof(saved), &saved);
+        ringbufPercpuFree(&percpu);
+        assert(percpu == 0);
+        memset(percpu_seen, 0, sizeof(percpu_seen));
+        percpu_received = 0;
+
+        pthread_t threads[PERCPU_THREADS];
+        percpu = ringbufPercpuNew(1024);
+        for (uintptr_t i = 0; i != PERCPU_THREADS; ++i)
+            assert(pthread_create(&threads[i], 0, percpu_producer,
+                                  (void *) i) == 0);
+        unsigned spins = 0;
+        while (percpu_received != PERCPU_THREADS * PERCPU_RECORDS) {
+            if (ringbufPercpuDrain(percpu, percpu_consume, 0) == 0)
+                sched_yield();
+            /* move the producers around, if there's anywhere to go */
+            if (CPU_COUNT(&saved) > 1 && ++spins % 64 == 0) {
+                int cpu = spins / 64 % CPU_SETSIZE;
+                while (!CPU_ISSET(cpu, &saved))
+                    cpu = (cpu + 1) % CPU_SETSIZE;
+                CPU_ZERO(&one);
+                CPU_SET(cpu, &one);
+                pthread_setaffinity_np(threads[spins / 64 % PERCPU_THREADS],
+                                       sizeof(one), &one);
+            }
+        }
+        for (unsigned i = 0; i != PERCPU_THREADS; ++i)
+            pthread_join(threads[i], 0);
+        assert(ringbufPercpuDrain(percpu, percpu_consume, 0) == 0);
+        ringbufPercpuFree(&percpu);
+    }
+    END_TEST(test_num);
+
+    /* asynchronous binary logging */
+    START_NEW_TEST(test_num);
+    {
+        FILE *out = tmpfile();
+        assert(out);
+        test_log = ringbufLogNew(fileno(out), 1024, RINGBUF_LOG_BLOCK);
+        assert(test_log);
+        assert(ringbufLogFormat(test_log, "bad %q\n") == -1);
+        assert(ringbufLogFormat(test_log, "%n") == -1);
+        test_log_fmt = ringbufLogFormat(test_log,
+                                        "t%d n%u s=[%-4s] x=%#lx f=%.2f 100%%\n");
+        assert(test_log_fmt == 0);
+        int plain = ringbufLogFormat(test_log, "plain %zu %p %lld %c\n");
+        assert(plain == 1);
+        assert(ringbufLog(test_log, plain, (size_t) 42, (void *) 0x10,
+                          -5LL, 'z') == 0);
+        ringbufLogFlush(test_log);
+        char line[128];
+        rewind(out);
+        assert(fgets(line, sizeof(line), out));
+        assert(strcmp(line, "plain 42 0x10 -5 z\n") == 0);
+
+        /* a conversion after literal text that already fills the line */
+        FILE *longout = tmpfile();
+        assert(longout);
+        ringbuf_log_t longlog = ringbufLogNew(fileno(longout), 1024,
+                                              RINGBUF_LOG_BLOCK);
+        char longfmt[4200 + 3];
+        memset(longfmt, 'x', 4200);
+        strcpy(longfmt + 4200, "%d");
+        int full = ringbufLogFormat(longlog, longfmt);
+        assert(full == 0);
+        assert(ringbufLog(longlog, full, 12345) == 0);
+        ringbufLogFree(&longlog);
+        assert(fseek(longout, 0, SEEK_END) == 0);
+        assert(ftell(longout) == 4096);
+        fclose(longout);
+
+        pthread_t threads[LOG_THREADS];
+        for (uintptr_t i = 0; i != LOG_THREADS; ++i)
+            assert(pthread_create(&threads[i], 0, log_producer,
+                                  (void *) i) == 0);
+        for (unsigned i = 0; i != LOG_THREADS; ++i)
+            pthread_join(threads[i], 0);
+        ringbufLogFlush(test_log);
+        assert(ringbufLogDropped(test_log) == 0);
+
+        unsigned next[LOG_THREADS] = {0};
+        rewind(out);
+        assert(fgets(line, sizeof(line), out));
+        while (fgets(line, sizeof(line), out)) {
+            int id;
+            unsigned n;
+            assert(sscanf(line, "t%d n%u", &id, &n) == 2);
+            assert(id >= 0 && id < LOG_THREADS && n == next[id]++);
+            char expect[128];
+            snprintf(expect, sizeof(expect),
+                     "t%d n%u s=[%-4s] x=%#lx f=%.2f 100%%\n",
+                     id, n, "abc" + n % 4, (unsigned long) n * 3, n / 4.0);
+            assert(strcmp(line, expect) == 0);
+        }
+        for (unsigned i = 0; i != LOG_THREADS; ++i)
+            assert(next[i] == LOG_MESSAGES);
+        ringbufLogFree(&test_log);
+        assert(test_log == 0);
+
+        /* with the drop policy, every message is written or counted */
+        rewind(out);
+        assert(ftruncate(fileno(out), 0) == 0);
+        test_log = ringbufLogNew(fileno(out), 512, RINGBUF_LOG_DROP);
+        test_log_fmt = ringbufLogFormat(test_log,
+                                        "t%d n%u s=[%-4s] x=%#lx f=%.2f 100%%\n");
+        unsigned logged = 0;
+        for (unsigned i = 0; i != LOG_MESSAGES; ++i)
+            logged += ringbufLog(test_log, test_log_fmt, 0, i, "", 0UL, 0.0) == 0;
+        assert(logged + ringbufLogDropped(test_log) == LOG_MESSAGES);
+        ringbufLogFree(&test_log);
+        rewind(out);
+        unsigned lines = 0;
+        while (fgets(line, sizeof(line), out))
+            ++lines;
+        assert(lines == logged);
+        fclose(out);
+    }
+    END_TEST(test_num);
+
+    /* flight recorder: dump on SIGUSR1, and on a crash */
+    START_NEW_TEST(test_num);
+    {
+        char path[] = "/tmp/ringbuf-test-dump.XXXXXX";
+        int fd = mkstemp(path);
+        assert(fd >= 0);
+        close(fd);
+
+        ringbuf_t rec = ringbufNew(100);
+        uint8_t events[250], got[250];
+        for (size_t i = 0; i != sizeof(events); ++i)
+            events[i] = i * 7;
+        /* records keep overwriting the oldest events, and wrap */
+        for (size_t i = 0; i != sizeof(events); i += 10)
+            ringbufMemcpyInto(rec, events + i, 10);
+        assert(ringbufIsFull(rec));
+        assert(ringbufTail(rec) > ringbufHead(rec));
+
+        /* a direct dump leaves the ring alone */
+        fd = open(path, O_RDWR | O_TRUNC);
+        assert(ringbufDump(fd, rec) == 0);
+        assert(lseek(fd, 0, SEEK_SET) == 0);
+        assert(read(fd, got, sizeof(got)) == 100);
+        assert(memcmp(got, events + 150, 100) == 0);
+        assert(ringbufIsFull(rec));
+        close(fd);
+
+        assert(ringbufDumpOnSignal(rec, path) == 0);
+        ringbufMemcpyInto(rec, "\xff", 1);
+        assert(raise(SIGUSR1) == 0);
+        fd = open(path, O_RDONLY);
+        assert(read(fd, got, sizeof(got)) == 100);
+        assert(memcmp(got, events + 151, 99) == 0 && got[99] == 0xff);
+        close(fd);
+        assert(ringbufDumpOnSignal(0, 0) == 0);
+
+        /* an empty ring dumps nothing */
+        ringbufReset(rec);
+        fd = open(path, O_RDWR | O_TRUNC);
+        assert(ringbufDump(fd, rec) == 0);
+        assert(lseek(fd, 0, SEEK_END) == 0);
+        close(fd);
+
+        /* crash signals dump, then still kill the program */
+        pid_t pid = fork();
+        assert(pid >= 0);
+        if (pid == 0) {
+            ringbufDumpOnSignal(rec, path);
+            ringbufMemcpyInto(rec, "last words", 10);
+            abort();
+        }
+        int status;
+        assert(waitpid(pid, &status, 0) == pid);
+        assert(WIFSIGNALED(status) && WTERMSIG(status) == SIGABRT);
+        fd = open(path, O_RDONLY);
+        assert(read(fd, got, sizeof(got)) == 10);
+        assert(memcmp(got, "last words", 10) == 0);
+        close(fd);
+
+        unlink(path);
+        ringbufFree(&rec);
+    }
+    END_TEST(test_num);
+
+    /* draining to a file in whole, aligned blocks */
+    START_NEW_TEST(test_num);
+    {
+        char path[] = "ringbuf-test-direct.XXXXXX";
+        int fd = mkstemp(path);
+        assert(fd >= 0);
+        close(fd);
+        /* not every file system supports O_DIRECT (e.g., tmpfs) */
+#ifdef O_DIRECT
+        fd = open(path, O_RDWR | O_DIRECT);
+        if (fd < 0)
+#endif
+            fd = open(path, O_RDWR);
+        assert(fd >= 0);
+
+        uint8_t *data = malloc(60000);
+        for (size_t i = 0; i != 60000; ++i)
+            data[i] = i * 13 + (i >> 8);
+
+        assert(ringbufDirectNew(fd, 100, 0, 0) == 0 && errno == EINVAL);
+        assert(ringbufDirectNew(fd, 0, 0, 1000) == 0 && errno == EINVAL);
+
+        /* a header block, then the data after it */
+        ringbuf_direct_t d = ringbufDirectNew(fd, 0, 0, 0);
+        assert(d);
+        uint8_t header[4096];
+        memset(header, 'H', sizeof(header));
+        assert(ringbufDirectWrite(d, header, sizeof(header)) == 0);
+        assert(ringbufDirectFree(&d) == 0);
+        assert(d == 0);
+        assert(lseek(fd, 0, SEEK_END) == 4096);
+
+        d = ringbufDirectNew(fd, 4096, 16384, 0);
+        assert(d);
+        assert(ringbufDirectWrite(d, data, 16385) == -1 && errno == EMSGSIZE);
+        size_t total = 0, len = 1;
+        while (total != 50000) {
+            len = len * 7 % 1000 + 1;
+            if (len > 50000 - total)
+                len = 50000 - total;
+            while (ringbufDirectWrite(d, data + total, len) != 0) {
+                assert(errno == EAGAIN);
+                sched_yield();
+            }
+            total += len;
+        }
+        assert(ringbufDirectFlush(d) == 0);
+        assert(lseek(fd, 0, SEEK_END) == 4096 + 50000);
+
+        /* the padded block is rewritten as data is added to it */
+        assert(ringbufDirectWrite(d, data + 50000, 10) == 0);
+        assert(ringbufDirectFlush(d) == 0);
+        assert(ringbufDirectFlush(d) == 0);
+        assert(lseek(fd, 0, SEEK_END) == 4096 + 50010);
+        assert(ringbufDirectFree(&d) == 0);
+        close(fd);
+
+        uint8_t *got = malloc(60000);
+        fd = open(path, O_RDONLY);
+        assert(read(fd, got, 60000) == 4096 + 50010);
+        for (size_t i = 0; i != 4096; ++i)
+            assert(got[i] == 'H');
+        assert(memcmp(got + 4096, data, 50000) == 0);
+        assert(memcmp(got + 4096 + 50000, data + 50000, 10) == 0);
+        close(fd);
+        unlink(path);
+        free(got);
+        free(data);
+    }
+    END_TEST(test_num);
+
+    /* FIFO arena allocation */
+    START_NEW_TEST(test_num);
+    {
+        ringbuf_arena_t arena = ringbufArenaNew(1000, 10);
+        assert(arena);
+        assert(ringbufArenaLive(arena) == 0);
+        assert(ringbufArenaBytesUsed(arena) == 0);
+
+        uint8_t *a = ringbufArenaAlloc(arena, 300, 1);
+        uint8_t *b = ringbufArenaAlloc(arena, 300, 64);
+        uint8_t *c = ringbufArenaAlloc(arena, 200, 8);
+        assert(a && b && c);
+        assert((uintptr_t) b % 64 == 0 && (uintptr_t) c % 8 == 0);
+        assert(a + 300 <= b && b + 300 <= c);
+        assert(ringbufArenaLive(arena) == 3);
+        size_t used = ringbufArenaBytesUsed(arena);
+        assert(used >= 800 + 3 * 4);
+        /* doesn't fit in one piece */
+        assert(ringbufArenaAlloc(arena, 1000 - used, 1) == 0);
+
+        /* an out-of-order release is deferred... */
+        ringbufArenaRelease(arena, b);
+        assert(ringbufArenaLive(arena) == 2);
+        assert(ringbufArenaBytesUsed(arena) == used);
+        /* ...until the objects before it are released */
+        ringbufArenaRelease(arena, a);
+        assert(ringbufArenaLive(arena) == 1);
+        assert(ringbufArenaBytesUsed(arena) < used - 600);
+
+        /* too big for the end of the buffer: wraps to its start whole */
+        uint8_t *d = ringbufArenaAlloc(arena, 250, 1);
+        assert(d && d < c);
+        assert(d + 250 <= c);
+        memset(d, 0xdd, 250);
+        ringbufArenaRelease(arena, c);
+        ringbufArenaRelease(arena, d);
+        assert(ringbufArenaLive(arena) == 0);
+        assert(ringbufArenaBytesUsed(arena) == 0);
+
+        /* at most maxlive (rounded up to 64) objects at once */
+        uint8_t *objs[64];
+        for (int i = 0; i != 64; ++i)
+            assert((objs[i] = ringbufArenaAlloc(arena, 1, 1)));
+        assert(ringbufArenaAlloc(arena, 1, 1) == 0);
+        for (int i = 63; i >= 0; --i)
+            ringbufArenaRelease(arena, objs[i]);
+        assert(ringbufArenaBytesUsed(arena) == 0);
+        ringbufArenaFree(&arena);
+        assert(arena == 0);
+
+        /* mostly in-order releases, with some stragglers */
+        arena = ringbufArenaNew(4096, 64);
+        struct { uint8_t *p; size_t len; uint8_t fill; } live[64];
+        size_t nlive = 0;
+        unsigned seed = 1;
+        for (unsigned i = 0; i != 100000; ++i) {
+            seed = seed * 1103515245 + 12345;
+            size_t len = (seed >> 8) % 300 + 1;
+            size_t align = (size_t) 1 << ((seed >> 20) % 7);
+            uint8_t *p = nlive == 64 ? 0 : ringbufArenaAlloc(arena, len, align);
+            if (p) {
+                assert((uintptr_t) p % align == 0);
+                memset(p, i & 0xff, len);
+                live[nlive].p = p;
+                live[nlive].len = len;
+                live[nlive].fill = i & 0xff;
+                ++nlive;
+            } else {
+                assert(nlive);
+                /* the oldest, or now and then some other one */
+                size_t k = (seed >> 16) % 4 == 0 ? (seed >> 4) % nlive : 0;
+                for (size_t j = 0; j != live[k].len; ++j)
+                    assert(live[k].p[j] == live[k].fill);
+                ringbufArenaRelease(arena, live[k].p);
+                memmove(&live[k], &live[k + 1], (nlive - k - 1) * sizeof(live[0]));
+                --nlive;
+            }
+            assert(ringbufArenaLive(arena) == nlive);
+        }
+        ringbufArenaFree(&arena);
+    }
+    END_TEST(test_num);
+
+    /* pools of compact ring buffers */
+    START_NEW_TEST(test_num);
+    {
+        assert(ringbufPoolNew((size_t) 1 << 24, 1024) == 0);
+        ringbuf_pool_t pool = ringbufPoolNew(1000, 100);
+        assert(pool);
+        assert(ringbufPoolRings(pool) == 1000);
+        assert(ringbufPoolCapacity(pool) == 128);
+        uint32_t found[8];
+        assert(ringbufPoolNonEmpty(pool, 0, found, 8) == 0);
+
+        char in[200], out[200];
+        for (int i = 0; i != 200; ++i)
+            in[i] = i;
+        /* fills up, never overflows */
+        assert(ringbufPoolMemcpyInto(pool, 7, in, 200) == 128);
+        assert(ringbufPoolBytesFree(pool, 7) == 0);
+        assert(ringbufPoolBytesUsed(pool, 6) == 0);
+        assert(ringbufPoolBytesUsed(pool, 8) == 0);
+        assert(ringbufPoolMemcpyFrom(out, pool, 7, 100) == 100);
+        assert(memcmp(out, in, 100) == 0);
+        /* wraps */
+        assert(ringbufPoolMemcpyInto(pool, 7, in + 128, 72) == 72);
+        struct iovec iov[2];
+        assert(ringbufPoolUsedIov(pool, 7, iov) == 2);
+        assert(iov[0].iov_len == 28 && iov[1].iov_len == 72);
+        assert(memcmp(iov[0].iov_base, in + 100, 28) == 0);
+        assert(memcmp(iov[1].iov_base, in + 128, 72) == 0);
+        ringbufPoolAdvanceTail(pool, 7, 20);
+        assert(ringbufPoolMemcpyFrom(out, pool, 7, 200) == 80);
+        assert(memcmp(out, in + 120, 80) == 0);
+        assert(ringbufPoolBytesUsed(pool, 7) == 0);
+
+        /* occupancy scans */
+        for (uint32_t i = 0; i < 1000; i += 100)
+            ringbufPoolMemcpyInto(pool, i + 3, "x", 1);
+        assert(ringbufPoolNonEmpty(pool, 0, found, 8) == 8);
+        assert(found[0] == 3 && found[7] == 703);
+        assert(ringbufPoolNonEmpty(pool, found[7] + 1, found, 8) == 2);
+        assert(found[0] == 803 && found[1] == 903);
+        ringbufPoolFree(&pool);
+        assert(pool == 0);
+    }
+    END_TEST(test_num);
+
+    /* giving the memory of empty ring buffers back to the kernel */
+    START_NEW_TEST(test_num);
+    {
+        size_t pagesize = sysconf(_SC_PAGESIZE);
+        ringbuf_t big = ringbufNew(8 * pagesize);
+        const void *start = ringbufHead(big);
+        uint8_t *chunk = malloc(5 * pagesize);
+        memset(chunk, 0x5a, 5 * pagesize);
+        ringbufMemcpyInto(big, chunk, 5 * pagesize);
+        assert(ringbufTrim(big) == 0);
+        assert(ringbufBytesUsed(big) == 5 * pagesize);
+        assert(ringbufMemcpyFrom(chunk, big, 5 * pagesize));
+        assert(ringbufHead(big) != start);
+        ssize_t released = ringbufTrim(big);
+        assert(released >= (ssize_t) (7 * pagesize));
+        assert(released <= (ssize_t) (8 * pagesize));
+        assert(ringbufIsEmpty(big));
+        assert(ringbufCapacity(big) == 8 * pagesize);
+        assert(ringbufHead(big) == start);
+        assert(ringbufTail(big) == start);
+        /* fresh pages come back on the next write */
+        ringbufMemcpyInto(big, chunk, 8 * pagesize);
+        assert(ringbufIsFull(big));
+        memset(chunk, 0, 5 * pagesize);
+        assert(ringbufMemcpyFrom(chunk, big, 5 * pagesize));
+        for (size_t i = 0; i != 5 * pagesize; ++i)
+            assert(chunk[i] == 0x5a);
+
+        /* periodic sweeps trim ring buffers once they've sat empty */
+        ringbuf_t idle[3];
+        const void *idle_start[3];
+        for (int i = 0; i != 3; ++i) {
+            idle[i] = ringbufNew(2 * pagesize);
+            idle_start[i] = ringbufHead(idle[i]);
+        }
+        ringbufMemcpyInto(idle[0], "busy", 4);
+        assert(ringbufTrimIdle(idle, 3, 0, 10) == 0);
+        assert(ringbufTrimIdle(idle, 3, 5, 10) == 0);
+        /* used in between sweeps: the idle period starts over */
+        ringbufMemcpyInto(idle[1], "x", 1);
+        ringbufMemcpyFrom(chunk, idle[1], 1);
+        assert(ringbufTrimIdle(idle, 3, 12, 10) == 1);
+        assert(ringbufHead(idle[2]) == idle_start[2]);
+        assert(ringbufHead(idle[1]) != idle_start[1]);
+        assert(ringbufTrimIdle(idle, 3, 22, 10) == 1);
+        assert(ringbufHead(idle[1]) == idle_start[1]);
+        assert(ringbufTrimIdle(idle, 3, 100, 10) == 0);
+        assert(ringbufBytesUsed(idle[0]) == 4);
+        for (int i = 0; i != 3; ++i)
+            ringbufFree(&idle[i]);
+        ringbufFree(&big);
+        free(chunk);
+    }
+    END_TEST(test_num);
+
+    /* lazy ring buffers allocate their buffer as it fills */
+    START_NEW_TEST(test_num);
+    {
+        ringbuf_t lazy = ringbufNewLazy(1000);
+        assert(ringbufCapacity(lazy) == 1000);
+        assert(ringbufBytesFree(lazy) == 1000);
+        assert(ringbufBufferSize(lazy) == 1);
+        assert(ringbufIsEmpty(lazy) && !ringbufIsFull(lazy));
+        assert(ringbufTrim(lazy) == 0);
+
+        uint8_t pattern[1000], out[1000];
+        for (size_t i = 0; i != sizeof(pattern); ++i)
+            pattern[i] = i * 7;
+        ringbufMemcpyInto(lazy, pattern, 10);
+        assert(ringbufBufferSize(lazy) == 64);
+        assert(ringbufBytesUsed(lazy) == 10);
+        assert(ringbufBytesFree(lazy) == 990);
+        /* wrap the small buffer, then grow past it */
+        ringbufMemcpyFrom(out, lazy, 8);
+        ringbufMemcpyInto(lazy, pattern + 10, 58);
+        assert(ringbufBufferSize(lazy) == 64);
+        assert(ringbufTail(lazy) > ringbufHead(lazy));
+        ringbufMemcpyInto(lazy, pattern + 68, 100);
+        assert(ringbufBufferSize(lazy) == 256);
+        assert(ringbufBytesUsed(lazy) == 160);
+        assert(ringbufMemcpyFrom(out, lazy, 160));
+        assert(memcmp(out, pattern + 8, 160) == 0);
+
+        /* full capacity, and only then overflow */
+        assert(ringbufReserve(lazy, 1000) == 0);
+        assert(ringbufReserve(lazy, 1001) == -1);
+        assert(ringbufBufferSize(lazy) == 1001);
+        ringbufMemcpyInto(lazy, pattern, 1000);
+        assert(ringbufIsFull(lazy));
+        ringbufMemcpyInto(lazy, pattern, 1);
+        assert(ringbufBytesUsed(lazy) == 1000);
+        assert(ringbufMemcpyFrom(out, lazy, 999));
+        assert(memcmp(out, pattern + 1, 999) == 0);
+        ringbufMemcpyFrom(out, lazy, 1);
+
+        /* trimming frees the buffer; transactions and reads grow it */
+        assert(ringbufTrim(lazy) == 1001);
+        assert(ringbufBufferSize(lazy) == 1);
+        ringbufTxnBegin(lazy);
+        assert(ringbufTxnAppend(lazy, pattern, 100) == 0);
+        assert(ringbufBufferSize(lazy) == 128);
+        assert(ringbufTxnAppend(lazy, pattern + 100, 100) == 0);
+        assert(ringbufBufferSize(lazy) == 256);
+        assert(ringbufTxnCommit(lazy) == 200);
+        assert(ringbufMemcpyFrom(out, lazy, 200));
+        assert(memcmp(out, pattern, 200) == 0);
+        assert(ringbufTrim(lazy) == 256);
+
+        int fds[2];
+        assert(pipe(fds) == 0);
+        assert(write(fds[1], pattern, 300) == 300);
+        size_t got = 0;
+        while (got < 300) {
+            ssize_t n = ringbufRead(fds[0], lazy, 300 - got);
+            assert(n > 0);
+            got += n;
+        }
+        assert(ringbufBufferSize(lazy) == 512);
+        assert(ringbufMemcpyFrom(out, lazy, 300));
+        assert(memcmp(out, pattern, 300) == 0);
+        close(fds[0]);
+        close(fds[1]);
+        ringbufFree(&lazy);
+        assert(lazy == 0);
+
+        /* each ring buffer has a byte of its own before it grows */
+        ringbuf_t none = ringbufNewLazy(0);
+        assert(ringbufCapacity(none) == 0);
+        assert(ringbufHead(none) > (const void *) none);
+        ringbufMemcpyInto(none, pattern, 10);
+        assert(ringbufIsEmpty(none));
+        ringbufFree(&none);
+
+        /* running out of memory fails the write, not the ring buffer */
+        size_t huge = (size_t) 1 << 60;
+        lazy = ringbufNewLazy(huge);
+        ringbufMemcpyInto(lazy, pattern, 10);
+        assert(ringbufReserve(lazy, huge - 20) == -1);
+        assert(ringbufMemset(lazy, 0, huge - 20) == 0);
+        assert(ringbufCapacity(lazy) == huge);
+        assert(ringbufBytesUsed(lazy) == 10);
+        assert(ringbufBufferSize(lazy) == 64);
+        ringbufMemcpyInto(lazy, pattern + 10, 100);
+        assert(ringbufBufferSize(lazy) == 128);
+        assert(ringbufMemcpyFrom(out, lazy, 110));
+        assert(memcmp(out, pattern, 110) == 0);
+        ringbufFree(&lazy);
+
+        /* never moves bytes the kernel may still read */
+        lazy = ringbufNewLazy(1000);
+        ringbufMemcpyInto(lazy, pattern, 10);
+        ringbufMarkSent(lazy, 4);
+        errno = 0;
+        assert(ringbufReserve(lazy, 100) == -1 && errno == EBUSY);
+        assert(ringbufMemcpyInto(lazy, pattern, 100) == 0);
+        assert(ringbufAck(lazy, 4) == 4);
+        assert(ringbufReserve(lazy, 100) == 0);
+        ringbufReset(lazy);
+        int pfd[2], sink[2];
+        assert(pipe(pfd) == 0 && pipe(sink) == 0);
+        fcntl(sink[0], F_SETFL, O_NONBLOCK);
+        fcntl(sink[1], F_SETFL, O_NONBLOCK);
+        while (write(sink[1], pattern, sizeof(pattern)) > 0)
+            ;
+        ringbufMemcpyInto(lazy, pattern, 10);
+        assert(ringbufSpliceOut(sink[1], pfd, lazy, 10) == -1);
+        assert(ringbufBytesUsed(lazy) == 10);
+        errno = 0;
+        assert(ringbufReserve(lazy, 500) == -1 && errno == EBUSY);
+        while (read(sink[0], out, sizeof(out)) > 0)
+            ;
+        assert(ringbufSpliceOut(sink[1], pfd, lazy, 10) == 10);
+        assert(ringbufReserve(lazy, 500) == 0);
+        close(pfd[0]);
+        close(pfd[1]);
+        close(sink[0]);
+        close(sink[1]);
+        ringbufFree(&lazy);
+    }
+    END_TEST(test_num);
+
+    /* small ring buffers keep their bytes inline until they outgrow it */
+    START_NEW_TEST(test_num);
+    {
+        ringbuf_t small = ringbufNewSmall(4096);
+        const uint8_t *home = ringbufHead(small);
+        assert(home > (const uint8_t *) small);
+        assert(home < (const uint8_t *) small + RINGBUF_SMALL);
+        assert(ringbufBufferSize(small) == RINGBUF_SMALL);
+        assert(ringbufCapacity(small) == 4096);
+        assert(ringbufBytesFree(small) == 4096);
+
+        uint8_t pattern[600], out[600];
+        for (size_t i = 0; i != sizeof(pattern); ++i)
+            pattern[i] = i * 13;
+        ringbufMemcpyInto(small, pattern, 200);
+        assert(ringbufMemcpyFrom(out, small, 100));
+        ringbufMemcpyInto(small, pattern + 200, 100);
+        assert(ringbufTail(small) > ringbufHead(small));
+        assert(ringbufBufferSize(small) == RINGBUF_SMALL);
+
+        /* outgrow the inline buffer, then drain back into it */
+        ringbufMemcpyInto(small, pattern + 300, 300);
+        assert(ringbufBufferSize(small) == 2 * RINGBUF_SMALL);
+        assert(ringbufHead(small) != home + 300);
+        assert(ringbufBytesUsed(small) == 500);
+        assert(ringbufMemcpyFrom(out, small, 499));
+        assert(memcmp(out, pattern + 100, 499) == 0);
+        assert(ringbufBufferSize(small) == 2 * RINGBUF_SMALL);
+        assert(ringbufMemcpyFrom(out, small, 1));
+        assert(out[0] == pattern[599]);
+        assert(ringbufBufferSize(small) == RINGBUF_SMALL);
+        assert(ringbufHead(small) == home);
+        assert(ringbufTail(small) == home);
+        assert(ringbufTrim(small) == 0);
+
+        /* so does a reset */
+        ringbufMemcpyInto(small, pattern, 300);
+        assert(ringbufBufferSize(small) == 2 * RINGBUF_SMALL);
+        ringbufReset(small);
+        assert(ringbufBufferSize(small) == RINGBUF_SMALL);
+        assert(ringbufHead(small) == home && ringbufIsEmpty(small));
+
+        /* a drained ring buffer with an open transaction stays put */
+        ringbufMemcpyInto(small, pattern, 400);
+        ringbufTxnBegin(small);
+        assert(ringbufTxnAppend(small, pattern, 50) == 0);
+        ringbufAdvanceTail(small, 400);
+        assert(ringbufBufferSize(small) == 2 * RINGBUF_SMALL);
+        assert(ringbufTxnCommit(small) == 50);
+        assert(ringbufMemcpyFrom(out, small, 50));
+        assert(memcmp(out, pattern, 50) == 0);
+        assert(ringbufBufferSize(small) == RINGBUF_SMALL);
+
+        /* moving between small ring buffers copies */
+        ringbuf_t other = ringbufNewSmall(4096);
+        const uint8_t *other_home = ringbufHead(other);
+        ringbufMemcpyInto(small, pattern, 10);
+        ringbufMove(other, small, 10);
+        assert(ringbufIsEmpty(small));
+        assert(ringbufHead(small) == home + 10);
+        assert(ringbufTail(other) == other_home);
+        assert(ringbufMemcpyFrom(out, other, 10));
+        assert(memcmp(out, pattern, 10) == 0);
+        ringbufFree(&other);
+        ringbufFree(&small);
+        assert(small == 0);
+
+        /* under RINGBUF_SMALL bytes of capacity, it never grows */
+        ringbuf_t tiny = ringbufNewSmall(100);
+        assert(ringbufBufferSize(tiny) == 101);
+        ringbufMemcpyInto(tiny, pattern, 150);
+        assert(ringbufBufferSize(tiny) == 101);
+        assert(ringbufIsFull(tiny));
+        assert(ringbufMemcpyFrom(out, tiny, 100));
+        assert(memcmp(out, pattern + 50, 100) == 0);
+        ringbufFree(&tiny);
+    }
+    END_TEST(test_num);
+
+    /* XOR masking and transforms in place, across the wrap */
+    START_NEW_TEST(test_num);
+    {
+        ringbuf_t ws = ringbufNew(100);
+        uint8_t payload[100], out[100], expect[100];
+        const uint8_t key[4] = {0x37, 0xfa, 0x21, 0x3d};
+        uint32_t mask;
+        memcpy(&mask, key, sizeof(mask));
+        for (size_t i = 0; i != sizeof(payload); ++i)
+            payload[i] = i * 11 + 3;
+
+        /* every wrap point and phase, at lengths around a SIMD chunk */
+        for (size_t wrap = 0; wrap != 40; ++wrap) {
+            for (size_t offset = 0; offset != 5; ++offset) {
+                for (size_t len = 0; len <= 70; len += 7) {
+                    ringbufReset(ws);
+                    memset(out, 0, 60);
+                    ringbufMemcpyInto(ws, out, 60 + wrap);
+                    ringbufMemcpyFrom(out, ws, 60 + wrap);
+                    ringbufMemcpyInto(ws, payload, offset + len + 3);
+                    assert(ringbufXorMask(ws, offset, len, mask) == 0);
+                    memcpy(expect, payload, offset + len + 3);
+                    for (size_t i = 0; i != len; ++i)
+                        expect[offset + i] ^= key[i % 4];
+                    assert(ringbufMemcpyFrom(out, ws, offset + len + 3));
+                    assert(memcmp(out, expect, offset + len + 3) == 0);
+                }
+            }
+        }
+
+        /* masking twice unmasks */
+        ringbufReset(ws);
+        ringbufMemcpyInto(ws, payload, 60);
+        ringbufMemcpyFrom(out, ws, 50);
+        ringbufMemcpyInto(ws, payload + 55, 45);
+        assert(ringbufHead(ws) < ringbufTail(ws));
+        assert(ringbufXorMask(ws, 0, 55, mask) == 0);
+        assert(ringbufXorMask(ws, 0, 55, mask) == 0);
+        assert(ringbufXorMask(ws, 0, 56, mask) == -1);
+        assert(ringbufXorMask(ws, 56, 0, mask) == -1);
+        assert(ringbufXorMask(ws, 55, 0, mask) == 0);
+
+        /* a transform sees each segment with its offset in the range */
+        size_t seen[4] = {0, 0, 0, 0};
+        assert(ringbufTransform(ws, 40, 15, record_segment, seen) == 0);
+        assert(seen[0] == 2);
+        assert(seen[1] == 11 && seen[2] == 4);
+        assert(seen[3] == 11);
+        assert(ringbufMemcpyFrom(out, ws, 55));
+        assert(memcmp(out, payload + 50, 10) == 0);
+        assert(memcmp(out + 10, payload + 55, 45) == 0);
+        ringbufFree(&ws);
+    }
+    END_TEST(test_num);
+
     ringbufFree(&rb1);
     ringbufFree(&rb2);
     free(buf);
@@ -0,0 +1,307 @@
+/*
+ * ringbuf-uring.c - io_uring(7) backend for filling and draining
+ * ring buffers.
+ *
+ * To the extent possible under law, the author(s) have dedicated all
+ * copyright and related and neighboring rights to this software to
+ * the public domain worldwide. This software is distributed without
+ * any warranty.
+ *
+ * You should have received a copy of the CC0 Public Domain Dedication
+ * along with this software. If not, see
+ * <http://creativecommons.org/publicdomain/zero/1.0/>.
+ */
+
+#include "ringbuf-uring.h"
+
+#ifdef __linux__
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/param.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+#ifndef RINGBUF_NO_ASSERT
+#include <assert.h>
+#endif /* !RINGBUF_NO_ASSERT */
+
+/*
+ * One queued or in-flight operation. The iovecs live here rather
+ * than on the caller's stack, so they stay valid until the kernel is
+ * done with them.
+ */
+struct ringbuf_uring_op
+{
+    ringbuf_t rb;
+    int fd;
+    int write;
+    struct iovec iov[2];
+    unsigned next_free;
+};
+
+struct ringbuf_uring_t
+{
+    int fd;
+
+    /* submission queue */
+    void *sq_ptr;
+    size_t sq_len;
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+    unsigned sq_entries;
+    struct io_uring_sqe *sqes;
+    unsigned to_submit;
+
+    /* completion queue (may share sq_ptr's mapping) */
+    void *cq_ptr;
+    size_t cq_len;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_cqe *cqes;
+
+    /* operation slots, sized to the CQ so completions can't overrun */
+    struct ringbuf_uring_op *ops;
+    unsigned nops;
+    unsigned free_op;
+};
+
+#define RINGBUF_URING_NO_OP ((unsigned) -1)
+
+static int sysUringSetup(unsigned entries, struct io_uring_params *p)
+{
+    return (int) syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sysUringEnter(int fd, unsigned to_submit, unsigned min_complete,
+                         unsigned flags)
+{
+    return (int) syscall(__NR_io_uring_enter, fd, to_submit, min_complete,
+                         flags, NULL, 0);
+}
+
+static int sysUringRegister(int fd, unsigned opcode, const void *arg,
+                            unsigned nr_args)
+{
+    return (int) syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+ringbuf_uring_t ringbufUringNew(unsigned entries)
+{
+    struct io_uring_params p;
+    ringbuf_uring_t u = calloc(1, sizeof(struct ringbuf_uring_t));
+    if (!u)
+        return 0;
+
+    memset(&p, 0, sizeof(p));
+    u->fd = sysUringSetup(entries, &p);
+    if (u->fd < 0) {
+        free(u);
+        return 0;
+    }
+
+    u->sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    u->cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP)
+        u->sq_len = u->cq_len = MAX(u->sq_len, u->cq_len);
+
+    u->sq_ptr = mmap(0, u->sq_len, PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQ_RING);
+    if (u->sq_ptr == MAP_FAILED)
+        goto fail_close;
+    if (p.features & IORING_FEAT_SINGLE_MMAP)
+        u->cq_ptr = u->sq_ptr;
+    else {
+        u->cq_ptr = mmap(0, u->cq_len, PROT_READ | PROT_WRITE,
+                         MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_CQ_RING);
+        if (u->cq_ptr == MAP_FAILED)
+            goto fail_sq;
+    }
+    u->sqes = mmap(0, p.sq_entries * sizeof(struct io_uring_sqe),
+                   PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                   u->fd, IORING_OFF_SQES);
+    if (u->sqes == MAP_FAILED)
+        goto fail_cq;
+
+    u->sq_head = (unsigned *) ((uint8_t *) u->sq_ptr + p.sq_off.head);
+    u->sq_tail = (unsigned *) ((uint8_t *) u->sq_ptr + p.sq_off.tail);
+    u->sq_mask = (unsigned *) ((uint8_t *) u->sq_ptr + p.sq_off.ring_mask);
+    u->sq_array = (unsigned *) ((uint8_t *) u->sq_ptr + p.sq_off.array);
+    u->sq_entries = p.sq_entries;
+    u->cq_head = (unsigned *) ((uint8_t *) u->cq_ptr + p.cq_off.head);
+    u->cq_tail = (unsigned *) ((uint8_t *) u->cq_ptr + p.cq_off.tail);
+    u->cq_mask = (unsigned *) ((uint8_t *) u->cq_ptr + p.cq_off.ring_mask);
+    u->cqes = (struct io_uring_cqe *) ((uint8_t *) u->cq_ptr + p.cq_off.cqes);
+
+    u->nops = p.cq_entries;
+    u->ops = malloc(u->nops * sizeof(struct ringbuf_uring_op));
+    if (!u->ops)
+        goto fail_sqes;
+    for (unsigned i = 0; i != u->nops; ++i)
+        u->ops[i].next_free = i + 1 < u->nops ? i + 1 : RINGBUF_URING_NO_OP;
+    u->free_op = 0;
+
+    return u;
+
+fail_sqes:
+    munmap(u->sqes, u->sq_entries * sizeof(struct io_uring_sqe));
+fail_cq:
+    if (u->cq_ptr != u->sq_ptr)
+        munmap(u->cq_ptr, u->cq_len);
+fail_sq:
+    munmap(u->sq_ptr, u->sq_len);
+fail_close:
+    close(u->fd);
+    free(u);
+    return 0;
+}
+
+void ringbufUringFree(ringbuf_uring_t *u)
+{
+    #ifndef RINGBUF_NO_ASSERT
+    assert(u && *u);
+    #endif /* !RINGBUF_NO_ASSERT */
+    munmap((*u)->sqes, (*u)->sq_entries * sizeof(struct io_uring_sqe));
+    if ((*u)->cq_ptr != (*u)->sq_ptr)
+        munmap((*u)->cq_ptr, (*u)->cq_len);
+    munmap((*u)->sq_ptr, (*u)->sq_len);
+    close((*u)->fd);
+    free((*u)->ops);
+    free(*u);
+    *u = 0;
+}
+
+int ringbufUringRegister(ringbuf_uring_t u, ringbuf_t *rings, unsigned n)
+{
+    struct iovec *iov = malloc(n * sizeof(struct iovec));
+    if (!iov)
+        return -1;
+
+    for (unsigned i = 0; i != n; ++i) {
+        /* the whole internal buffer starts one buffer size before its end */
+        iov[i].iov_len = ringbufBufferSize(rings[i]);
+        iov[i].iov_base = (uint8_t *) ringbufEnd(rings[i]) - iov[i].iov_len;
+    }
+    int r = sysUringRegister(u->fd, IORING_REGISTER_BUFFERS, iov, n);
+    free(iov);
+    return r < 0 ? -1 : 0;
+}
+
+/*
+ * Queue one SQE describing op. Fixed-buffer operations take a single
+ * contiguous range, so only the first iovec is used for them.
+ */
+static int ringbufUringQueue(ringbuf_uring_t u, int fd, ringbuf_t rb,
+                             int write, int niov, const struct iovec *iov,
+                             int bufidx)
+{
+    unsigned tail = *u->sq_tail;
+    unsigned head = __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE);
+    if (tail - head == u->sq_entries || u->free_op == RINGBUF_URING_NO_OP) {
+        errno = EBUSY;
+        return -1;
+    }
+
+    unsigned slot = u->free_op;
+    struct ringbuf_uring_op *op = &u->ops[slot];
+    u->free_op = op->next_free;
+    op->rb = rb;
+    op->fd = fd;
+    op->write = write;
+    memcpy(op->iov, iov, niov * sizeof(struct iovec));
+
+    unsigned idx = tail & *u->sq_mask;
+    struct io_uring_sqe *sqe = &u->sqes[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->fd = fd;
+    sqe->user_data = slot;
+    if (bufidx >= 0) {
+        sqe->opcode = write ? IORING_OP_WRITE_FIXED : IORING_OP_READ_FIXED;
+        sqe->addr = (uintptr_t) op->iov[0].iov_base;
+        sqe->len = op->iov[0].iov_len;
+        sqe->buf_index = bufidx;
+    } else {
+        sqe->opcode = write ? IORING_OP_WRITEV : IORING_OP_READV;
+        sqe->addr = (uintptr_t) op->iov;
+        sqe->len = niov;
+    }
+    /* streams have no meaningful offset: use the file position */
+    sqe->off = (uint64_t) -1;
+
+    u->sq_array[idx] = idx;
+    __atomic_store_n(u->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    ++u->to_submit;
+    return 0;
+}
+
+int ringbufUringPrepRead(ringbuf_uring_t u, int fd, ringbuf_t rb,
+                         size_t count, int bufidx)
+{
+    struct iovec iov[2];
+    int niov = ringbufFreeIov(rb, count, iov);
+    if (niov == 0) {
+        /* a zero-length read would complete like end of file */
+        errno = EAGAIN;
+        return -1;
+    }
+    return ringbufUringQueue(u, fd, rb, 0, niov, iov, bufidx);
+}
+
+int ringbufUringPrepWrite(ringbuf_uring_t u, int fd, ringbuf_t rb,
+                          size_t count, int bufidx)
+{
+    struct iovec iov[2];
+    /* bytes in flight stay put until they're acknowledged */
+    int niov = ringbufUsedIov(rb, ringbufBytesInflight(rb) ? 0 : count, iov);
+    if (niov == 0) {
+        errno = EAGAIN;
+        return -1;
+    }
+    return ringbufUringQueue(u, fd, rb, 1, niov, iov, bufidx);
+}
+
+int ringbufUringSubmit(ringbuf_uring_t u, unsigned wait_nr)
+{
+    int r = sysUringEnter(u->fd, u->to_submit, wait_nr,
+                          wait_nr ? IORING_ENTER_GETEVENTS : 0);
+    if (r < 0)
+        return -1;
+    u->to_submit -= r;
+    return r;
+}
+
+int ringbufUringReap(ringbuf_uring_t u, struct ringbuf_uring_done *done,
+                     unsigned max)
+{
+    unsigned head = *u->cq_head;
+    unsigned tail = __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE);
+    unsigned n = 0;
+
+    while (head != tail && n != max) {
+        const struct io_uring_cqe *cqe = &u->cqes[head & *u->cq_mask];
+        unsigned slot = (unsigned) cqe->user_data;
+        struct ringbuf_uring_op *op = &u->ops[slot];
+
+        if (cqe->res > 0) {
+            if (op->write)
+                ringbufAdvanceTail(op->rb, cqe->res);
+            else
+                ringbufAdvanceHead(op->rb, cqe->res);
+        }
+        done[n].rb = op->rb;
+        done[n].fd = op->fd;
+        done[n].write = op->write;
+        done[n].res = cqe->res;
+        ++n;
+
+        op->next_free = u->free_op;
+        u->free_op = slot;
+        ++head;
+    }
+    __atomic_store_n(u->cq_head, head, __ATOMIC_RELEASE);
+
+    return n;
+}
+
+#endif /* __linux__ */
@@ -0,0 +1,140 @@
+#ifndef INCLUDED_RINGBUF_URING_H
+#define INCLUDED_RINGBUF_URING_H
+
+/*
+ * ringbuf-uring.h - io_uring(7) backend for filling and draining
+ * ring buffers.
+ *
+ * To the extent possible under law, the author(s) have dedicated all
+ * copyright and related and neighboring rights to this software to
+ * the public domain worldwide. This software is distributed without
+ * any warranty.
+ *
+ * You should have received a copy of the CC0 Public Domain Dedication
+ * along with this software. If not, see
+ * <http://creativecommons.org/publicdomain/zero/1.0/>.
+ */
+
+/*
+ * ringbufRead and ringbufWrite cost one system call each. With many
+ * ring buffers (e.g., one per socket), a ringbuf_uring_t lets you
+ * queue readv/writev operations against the free and used segments
+ * of any number of ring buffers, submit all of them with a single
+ * io_uring_enter(2), and reap the completions later; head and tail
+ * pointers are advanced as each completion is reaped.
+ *
+ * This backend talks to the kernel directly and does not need
+ * liburing. It is only available on Linux.
+ *
+ * While an operation is in flight, the kernel owns the ring buffer
+ * segments it was queued against. At most one read and one write may
+ * be in flight per ring buffer at any time, and the ring buffer must
+ * not be modified by other means on the same side (head for reads,
+ * tail for writes) until the operation has been reaped.
+ */
+
+#ifdef __linux__
+
+#include "ringbuf.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct ringbuf_uring_t *ringbuf_uring_t;
+
+/*
+ * A reaped completion, as returned by ringbufUringReap. res is the
+ * value the equivalent readv(2)/writev(2) call would have returned,
+ * or -errno on failure. By the time it is returned, rb's head (for a
+ * read) or tail (for a write) pointer has already been advanced by
+ * res bytes.
+ */
+struct ringbuf_uring_done
+{
+    ringbuf_t rb;
+    int fd;
+    int write;
+    int res;
+};
+
+/*
+ * Create a new io_uring instance with room for at least entries
+ * queued operations.
+ *
+ * Returns the new object, or 0 if io_uring is unavailable or there
+ * isn't enough memory (errno is set).
+ */
+ringbuf_uring_t ringbufUringNew(unsigned entries);
+
+/*
+ * Tear down the io_uring instance, and, as a side effect, set the
+ * pointer to 0. Operations still in flight are abandoned; their ring
+ * buffers' pointers are not advanced.
+ */
+void ringbufUringFree(ringbuf_uring_t *u);
+
+/*
+ * Register the internal buffers of n ring buffers as io_uring fixed
+ * buffers; rings[i] gets buffer index i. Operations queued with that
+ * index use IORING_OP_READ_FIXED/IORING_OP_WRITE_FIXED, which skip
+ * the per-operation page pinning. Fixed operations are not vectored,
+ * so they only cover the first contiguous segment, just like
+ * ringbufRead and ringbufWrite.
+ *
+ * Returns 0 on success, or -1 on failure (errno is set).
+ */
+int ringbufUringRegister(ringbuf_uring_t u, ringbuf_t *rings, unsigned n);
+
+/*
+ * Queue a read of up to count bytes from fd into rb's free segments
+ * (see ringbufFreeIov). The read never overflows rb. bufidx is the
+ * fixed buffer index of rb from ringbufUringRegister, or -1.
+ *
+ * Nothing is sent to the kernel until ringbufUringSubmit is called.
+ * Returns 0 on success, or -1 if the submission queue is full
+ * (errno is EBUSY; submit and reap, then try again) or there is no
+ * room in rb, or count is 0 (errno is EAGAIN; nothing is queued,
+ * since a zero-length read would complete as if at end of file).
+ */
+int ringbufUringPrepRead(ringbuf_uring_t u, int fd, ringbuf_t rb,
+                         size_t count, int bufidx);
+
+/*
+ * Queue a write of up to count bytes from rb's used segments (see
+ * ringbufUsedIov), starting at its tail pointer, to fd. bufidx is as
+ * for ringbufUringPrepRead. Nothing is written while rb has bytes in
+ * flight (see ringbufBytesInflight), and none may be sent from rb
+ * until the write has been reaped.
+ *
+ * Returns 0 on success, or -1 if the submission queue is full (errno
+ * is EBUSY) or there is nothing to write (errno is EAGAIN; nothing
+ * is queued).
+ */
+int ringbufUringPrepWrite(ringbuf_uring_t u, int fd, ringbuf_t rb,
+                          size_t count, int bufidx);
+
+/*
+ * Submit every queued operation with one io_uring_enter(2) call,
+ * waiting until at least wait_nr completions are available.
+ *
+ * Returns the number of operations submitted, or -1 on failure
+ * (errno is set).
+ */
+int ringbufUringSubmit(ringbuf_uring_t u, unsigned wait_nr);
+
+/*
+ * Reap up to max completions without entering the kernel, advance
+ * the corresponding ring buffers' head or tail pointers, and
+ * describe them in done. Returns the number of completions reaped.
+ */
+int ringbufUringReap(ringbuf_uring_t u, struct ringbuf_uring_done *done,
+                     unsigned max);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __linux__ */
+
+#endif /* INCLUDED_RINGBUF_URING_H */
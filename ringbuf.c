@@ -20,14 +20,17 @@
  * to kick out unwanted asserts at ease
  */
 
+#ifdef __linux__
+#define _GNU_SOURCE     /* splice(2), vmsplice(2) */
+#endif
+
 #include "ringbuf.h"
 
-/*
+#include <limits.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/types.h>
-*/
 
 /*
  * The #include sys/uio.h is not really needed, but was 
@@ -39,6 +42,33 @@
 #include <unistd.h>
 #include <sys/param.h>
 
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/mman.h>
+
+#ifdef __linux__
+#include <netinet/in.h>
+#include <sys/ioctl.h>
+#include <linux/errqueue.h>
+#endif /* __linux__ */
+
+/*
+ * Define RINGBUF_NO_SIMD to always use the portable word-at-a-time
+ * loops.
+ */
+#if defined(__SSE2__) && !defined(RINGBUF_NO_SIMD)
+#include <emmintrin.h>
+#define RINGBUF_SSE2 1
+#endif
+
 
 /*
 * To remove assert() calls in production code by #define
@@ -46,6 +76,15 @@
 */
 //#define RINGBUF_NO_ASSERT
 
+/*
+ * The real-time profile (see ringbuf.h) has no asserts: a failed
+ * assert would call abort(3), and even a passing one costs a branch
+ * on the worst-case path.
+ */
+#if defined(RINGBUF_REALTIME) && !defined(RINGBUF_NO_ASSERT)
+#define RINGBUF_NO_ASSERT
+#endif
+
 #ifndef RINGBUF_NO_ASSERT
 #include <assert.h>
 #endif /* !RINGBUF_NO_ASSERT */
@@ -69,11 +108,96 @@
 * the ring buffer
 */
 
-struct ringbuf_t
+struct ringbuf_s
 {
     uint8_t *buf;
     uint8_t *head, *tail;
     size_t size;
+    size_t max_size;            /* what a lazy ring buffer may grow to */
+    int lazy;                   /* RINGBUF_LAZY_*, or 0 if it can't grow */
+    size_t inflight;            /* sent after tail, not yet released */
+    size_t pinned;              /* of those, sent with MSG_ZEROCOPY */
+    size_t spliced;             /* at tail, still referenced by a pipe */
+    size_t staged;              /* written after head, not yet committed */
+    struct ringbuf_zc_t *zc;    /* MSG_ZEROCOPY sends awaiting completion */
+    struct ringbuf_group_s *group;  /* readiness bitmap to notify, if any */
+    size_t group_slot;
+    int idle;                   /* RINGBUF_IDLE_*, for ringbufTrimIdle */
+    uint64_t idle_since;
+    uint8_t small[];            /* a growing ring buffer's inline buffer */
+};
+
+/*
+ * A ring buffer's idle state: not seen empty by ringbufTrimIdle since
+ * it was last written to, seen empty since idle_since, or trimmed.
+ */
+#define RINGBUF_IDLE_BUSY 0
+#define RINGBUF_IDLE_EMPTY 1
+#define RINGBUF_IDLE_TRIMMED 2
+
+/*
+ * A lazy ring buffer starts out with a 1-byte inline buffer (capacity
+ * 0), and grows into allocated buffers, starting with
+ * RINGBUF_LAZY_MIN bytes.
+ */
+#define RINGBUF_LAZY_MIN 64
+
+/*
+ * How a growing ring buffer started out, and goes back to when it's
+ * trimmed: with a 1-byte inline buffer (ringbufNewLazy), or with a
+ * RINGBUF_SMALL-byte one (ringbufNewSmall).
+ */
+#define RINGBUF_LAZY_HEAP 1
+#define RINGBUF_LAZY_SMALL 2
+
+struct ringbuf_group_s
+{
+    size_t nslots;
+    uint64_t *ready;            /* one bit per slot, set when non-empty */
+    ringbuf_t *rings;
+    size_t *free;               /* stack of free slots */
+    size_t nfree;
+    size_t scan;                /* word ringbufGroupPoll resumes from */
+};
+
+#define RINGBUF_GROUP_WORDS(n) (((n) + 63) / 64)
+
+/*
+ * Arena objects are numbered in allocation order; object seq's mark
+ * bit and end position (the head pointer just after it) live in slot
+ * seq & mask. Objects oldest through next - 1 are live, or released
+ * but not yet reclaimed.
+ */
+struct ringbuf_arena_s
+{
+    ringbuf_t rb;
+    uint32_t oldest, next;
+    uint32_t mask;
+    size_t live;
+    uint64_t *marks;            /* one bit per slot, set when released */
+    uint8_t **ends;
+};
+
+#define RINGBUF_ARENA_HDR sizeof(uint32_t)
+
+/*
+ * A pooled ring buffer's head and tail are free-running counters:
+ * head - tail is the number of bytes used, and counter & pool->mask
+ * is the offset in the ring buffer's buffer, which starts at
+ * base + (index << pool->shift).
+ */
+struct ringbuf_compact_s
+{
+    uint32_t head, tail;
+};
+
+struct ringbuf_pool_s
+{
+    uint8_t *base;
+    struct ringbuf_compact_s *rings;
+    uint32_t nrings;
+    uint32_t mask;
+    unsigned shift;
 };
 
 
@@ -88,11 +212,16 @@ struct ringbuf_t
 */
 ringbuf_t ringbufNew(size_t capacity)
 {
-    ringbuf_t rb = malloc(sizeof(struct ringbuf_t));
+    ringbuf_t rb = malloc(sizeof(struct ringbuf_s));
     if (rb) {
 
         /* One byte is used for detecting the full condition and to keep distance. */
         rb->size = capacity + 1;  //distance of one byte to keep distance from overrun
+        rb->max_size = rb->size;
+        rb->lazy = 0;
+        rb->zc = 0;
+        rb->group = 0;
+        rb->idle = RINGBUF_IDLE_BUSY;
         rb->buf = malloc(rb->size);
         if (rb->buf)
             ringbufReset(rb);
@@ -104,6 +233,50 @@ ringbuf_t ringbufNew(size_t capacity)
     return rb;
 }
 
+/*
+ * The buffer a growing ring buffer starts out with, and its size.
+ */
+static uint8_t *ringbufHome(ringbuf_t rb)
+{
+    return rb->small;
+}
+
+static size_t ringbufHomeSize(const struct ringbuf_s *rb)
+{
+    return rb->lazy == RINGBUF_LAZY_SMALL ?
+        MIN(rb->max_size, RINGBUF_SMALL) : 1;
+}
+
+static ringbuf_t ringbufNewGrowing(size_t capacity, int lazy)
+{
+    size_t small = lazy == RINGBUF_LAZY_SMALL ?
+        MIN(capacity + 1, RINGBUF_SMALL) : 1;
+    ringbuf_t rb = malloc(sizeof(struct ringbuf_s) + small);
+    if (rb) {
+        rb->max_size = capacity + 1;
+        rb->lazy = lazy;
+        rb->pinned = 0;
+        rb->spliced = 0;
+        rb->buf = ringbufHome(rb);
+        rb->size = ringbufHomeSize(rb);
+        rb->zc = 0;
+        rb->group = 0;
+        rb->idle = RINGBUF_IDLE_BUSY;
+        ringbufReset(rb);
+    }
+    return rb;
+}
+
+ringbuf_t ringbufNewLazy(size_t capacity)
+{
+    return ringbufNewGrowing(capacity, RINGBUF_LAZY_HEAP);
+}
+
+ringbuf_t ringbufNewSmall(size_t capacity)
+{
+    return ringbufNewGrowing(capacity, RINGBUF_LAZY_SMALL);
+}
+
 /*
 * @brief Bind existing memory to a ringbuffer structure and make it a ringbuffer.
 *
@@ -140,19 +313,51 @@ ringbuf_t ringbufBind(ringbuf_t ringbuffer, uint8_t *bufferAddress) {
 		ringbuffer->tail=NULL;
 		ringbuffer->size=0;
 	}
+	ringbuffer->inflight=0;
+	ringbuffer->pinned=0;
+	ringbuffer->spliced=0;
+	ringbuffer->staged=0;
+	ringbuffer->zc=NULL;
+	ringbuffer->group=NULL;
+	ringbuffer->idle=RINGBUF_IDLE_BUSY;
+	ringbuffer->max_size=ringbuffer->size;
+	ringbuffer->lazy=0;
 	return ringbuffer;
 }	
 		
 		
 
-size_t ringbufBufferSize(const struct ringbuf_t *rb)
+size_t ringbufBufferSize(const struct ringbuf_s *rb)
 {
     return rb->size;
 }
 
+/*
+ * Free an empty growing ring buffer's buffer, and go back to the one
+ * it started with. Returns the number of bytes freed.
+ */
+static size_t ringbufGoHome(ringbuf_t rb)
+{
+    if (rb->buf == ringbufHome(rb))
+        return 0;
+    size_t released = rb->size;
+    free(rb->buf);
+    rb->buf = rb->head = rb->tail = ringbufHome(rb);
+    rb->size = ringbufHomeSize(rb);
+    return released;
+}
+
 void ringbufReset(ringbuf_t rb)
 {
+    /* a small ring buffer goes back to its inline buffer, unless the
+     * kernel may still be reading the other one */
+    if (rb->lazy == RINGBUF_LAZY_SMALL && !rb->pinned && !rb->spliced)
+        ringbufGoHome(rb);
     rb->head = rb->tail = rb->buf;
+    rb->inflight = 0;
+    rb->pinned = 0;
+    rb->spliced = 0;
+    rb->staged = 0;
 }
 
 void ringbufFree(ringbuf_t *rb)
@@ -160,57 +365,191 @@ void ringbufFree(ringbuf_t *rb)
     #ifndef RINGBUF_NO_ASSERT
     assert(rb && *rb);
     #endif /* !RINGBUF_NO_ASSERT */
-    free((*rb)->buf);
+    if ((*rb)->group)
+        ringbufGroupRemove(*rb);
+    free((*rb)->zc);
+    if (!(*rb)->lazy || (*rb)->buf != ringbufHome(*rb))
+        free((*rb)->buf);
     free(*rb);
     *rb = 0;
 }
 
-size_t ringbufCapacity(const struct ringbuf_t *rb)
+ssize_t ringbufTrim(ringbuf_t rb)
+{
+    if (!ringbufIsEmpty(rb) || rb->staged)
+        return 0;
+    rb->head = rb->tail = rb->buf;
+    rb->idle = RINGBUF_IDLE_TRIMMED;
+
+    /* a growing ring buffer goes back to the buffer it started with */
+    if (rb->lazy)
+        return ringbufGoHome(rb);
+
+#if defined(MADV_FREE) || defined(MADV_DONTNEED)
+    static uintptr_t pagesize;
+    if (!pagesize)
+        pagesize = sysconf(_SC_PAGESIZE);
+
+    /* only the pages that lie entirely within the buffer */
+    uintptr_t start = ((uintptr_t) rb->buf + pagesize - 1) & ~(pagesize - 1);
+    uintptr_t end = (uintptr_t) ringbufEnd(rb) & ~(pagesize - 1);
+    if (end <= start)
+        return 0;
+    int r = -1;
+#ifdef MADV_FREE
+    r = madvise((void *) start, end - start, MADV_FREE);
+#endif
+#ifdef MADV_DONTNEED
+    /* kernels older than Linux 4.5 don't have MADV_FREE */
+    if (r < 0)
+        r = madvise((void *) start, end - start, MADV_DONTNEED);
+#endif
+    return r < 0 ? -1 : (ssize_t) (end - start);
+#else
+    return 0;
+#endif
+}
+
+size_t ringbufTrimIdle(ringbuf_t *rings, size_t n, uint64_t now,
+                       uint64_t idle)
 {
-    return ringbufBufferSize(rb) - 1;
+    size_t ntrimmed = 0;
+
+    for (size_t i = 0; i != n; ++i) {
+        ringbuf_t rb = rings[i];
+        if (!ringbufIsEmpty(rb) || rb->staged) {
+            rb->idle = RINGBUF_IDLE_BUSY;
+        } else if (rb->idle == RINGBUF_IDLE_BUSY) {
+            rb->idle = RINGBUF_IDLE_EMPTY;
+            rb->idle_since = now;
+        } else if (rb->idle == RINGBUF_IDLE_EMPTY &&
+                   now - rb->idle_since >= idle) {
+            ringbufTrim(rb);
+            ++ntrimmed;
+        }
+    }
+    return ntrimmed;
 }
 
-/*
- * Return a pointer to one-past-the-end of the ring buffer's
- * contiguous buffer. You shouldn't normally need to use this function
- * unless you're writing a new ringbuf_* function.
- */
-static const uint8_t *ringbufEnd(const struct ringbuf_t *rb)
+size_t ringbufCapacity(const struct ringbuf_s *rb)
+{
+    return rb->max_size - 1;
+}
+
+const uint8_t *ringbufEnd(const struct ringbuf_s *rb)
 {
     return rb->buf + ringbufBufferSize(rb);
 }
 
-size_t ringbufBytesFree(const struct ringbuf_t *rb)
+/*
+ * The free space in rb's buffer as it is now. Only a lazy ring
+ * buffer that hasn't grown all the way has less room than
+ * ringbufBytesFree.
+ */
+static size_t ringbufRoom(const struct ringbuf_s *rb)
 {
     ssize_t s = rb->head - rb->tail;
     if (s >= 0)
-        return ringbufCapacity(rb) - s;
+        return ringbufBufferSize(rb) - 1 - s;
     else
         return -s - 1;
 }
 
+size_t ringbufBytesFree(const struct ringbuf_s *rb)
+{
+    return ringbufRoom(rb) + (rb->max_size - rb->size);
+}
+
 size_t
-ringbufBytesUsed(const struct ringbuf_t *rb)
+ringbufBytesUsed(const struct ringbuf_s *rb)
+{
+    return ringbufBufferSize(rb) - 1 - ringbufRoom(rb);
+}
+
+/*
+ * Make room for count more bytes (not counting any staged by an open
+ * transaction) in a lazy ring buffer, as far as its capacity allows,
+ * by moving its bytes to the start of a bigger buffer: the smallest
+ * that fits them, doubling from RINGBUF_LAZY_MIN bytes.
+ *
+ * Returns 0 if there is room for count bytes, or -1 if not: because
+ * count bytes don't fit in the capacity, or because there isn't
+ * enough memory (errno is ENOMEM, and the buffer is unchanged).
+ */
+static int ringbufGrow(ringbuf_t rb, size_t count)
+{
+    size_t room = ringbufRoom(rb) - rb->staged;
+    if (room >= count)
+        return 0;
+    if (rb->size == rb->max_size)
+        return -1;
+    /* the kernel may still read bytes sent or spliced from the old buffer */
+    if (rb->inflight || rb->spliced) {
+        errno = EBUSY;
+        return -1;
+    }
+
+    size_t used = ringbufBytesUsed(rb);
+    size_t keep = used + rb->staged;
+    size_t size = MAX(rb->size, RINGBUF_LAZY_MIN);
+    while (size - 1 - keep < count && size < rb->max_size)
+        size = size > rb->max_size / 2 ? rb->max_size : size * 2;
+    size = MIN(size, rb->max_size);
+
+    uint8_t *buf = malloc(size);
+    if (!buf)
+        return -1;
+    const uint8_t *bufend = ringbufEnd(rb);
+    size_t n = MIN((size_t) (bufend - rb->tail), keep);
+    memcpy(buf, rb->tail, n);
+    memcpy(buf + n, rb->buf, keep - n);
+    if (rb->buf != ringbufHome(rb))
+        free(rb->buf);
+    rb->buf = rb->tail = buf;
+    rb->head = buf + used;
+    rb->size = size;
+    return size - 1 - keep >= count ? 0 : -1;
+}
+
+int ringbufReserve(ringbuf_t rb, size_t count)
+{
+    return ringbufGrow(rb, count);
+}
+
+/*
+ * Grow a lazy ring buffer for a write of count bytes. Returns -1 if
+ * it needed to grow and there wasn't enough memory: then the write
+ * fails, rather than overflowing a buffer smaller than the capacity.
+ * A write that doesn't fit in the capacity overflows as usual.
+ */
+static int ringbufGrowFor(ringbuf_t rb, size_t count)
+{
+    if (rb->lazy && ringbufGrow(rb, count) < 0 && rb->size != rb->max_size)
+        return -1;
+    return 0;
+}
+
+size_t ringbufBytesInflight(const struct ringbuf_s *rb)
 {
-    return ringbufCapacity(rb) - ringbufBytesFree(rb);
+    return rb->inflight;
 }
 
-int ringbufIsFull(const struct ringbuf_t *rb)
+int ringbufIsFull(const struct ringbuf_s *rb)
 {
     return ringbufBytesFree(rb) == 0;
 }
 
-int ringbufIsEmpty(const struct ringbuf_t *rb)
+int ringbufIsEmpty(const struct ringbuf_s *rb)
 {
     return ringbufBytesFree(rb) == ringbufCapacity(rb);
 }
 
-const void *ringbufTail(const struct ringbuf_t *rb)
+const void *ringbufTail(const struct ringbuf_s *rb)
 {
     return rb->tail;
 }
 
-const void *ringbufHead(const struct ringbuf_t *rb)
+const void *ringbufHead(const struct ringbuf_s *rb)
 {
     return rb->head;
 }
@@ -223,42 +562,164 @@ const void *ringbufHead(const struct ringbuf_t *rb)
 static uint8_t *ringbufNextp(ringbuf_t rb, const uint8_t *p)
 {
     /*
-     * The assert guarantees the expression (++p - rb->buf) is
-     * non-negative; therefore, the modulus operation is safe and
-     * portable.
+     * The assert guarantees that ++p is at most one past the end of
+     * the buffer, so a compare (not a modulus, which divides) is
+     * enough to wrap it.
      */
+    const uint8_t *bufend = ringbufEnd(rb);
     #ifndef RINGBUF_NO_ASSERT
-    assert((p >= rb->buf) && (p < ringbufEnd(rb)));
+    assert((p >= rb->buf) && (p < bufend));
     #endif /* !RINGBUF_NO_ASSERT */
-    return rb->buf + ((++p - rb->buf) % ringbufBufferSize(rb));
+    return ++p == bufend ? rb->buf : (uint8_t *) p;
 }
 
-size_t ringbufFindchr(const struct ringbuf_t *rb, int c, size_t offset)
+/*
+ * Given a ring buffer rb and a pointer to a location within its
+ * contiguous buffer, return a pointer to the logical location n
+ * bytes further on, following the wrap. n must be smaller than the
+ * buffer size.
+ */
+static uint8_t *ringbufAdvancep(const struct ringbuf_s *rb, const uint8_t *p,
+                                size_t n)
 {
     const uint8_t *bufend = ringbufEnd(rb);
-    size_t bytes_used = ringbufBytesUsed(rb);
-    if (offset >= bytes_used)
-        return bytes_used;
-
-    const uint8_t *start = rb->buf +
-        (((rb->tail - rb->buf) + offset) % ringbufBufferSize(rb));
     #ifndef RINGBUF_NO_ASSERT
-    assert(bufend > start);
+    assert((p >= rb->buf) && (p < bufend));
+    assert(n < ringbufBufferSize(rb));
     #endif /* !RINGBUF_NO_ASSERT */
-    size_t n = MIN(bufend - start, bytes_used - offset);
-    const uint8_t *found = memchr(start, c, n);
-    if (found)
-        return offset + (found - start);
+    if ((size_t) (bufend - p) > n)
+        return (uint8_t *) p + n;
     else
-        return ringbufFindchr(rb, c, offset + n);
+        return (uint8_t *) p + n - ringbufBufferSize(rb);
+}
+
+/*
+ * Account for count bytes released from rb's tail by a consuming
+ * operation, or by an acknowledgement: bytes released that way are no
+ * longer in flight, and a small ring buffer that has been drained
+ * goes back to its inline buffer.
+ */
+static void ringbufReleased(ringbuf_t rb, size_t count)
+{
+    rb->inflight = rb->inflight > count ? rb->inflight - count : 0;
+    if (rb->lazy == RINGBUF_LAZY_SMALL && rb->head == rb->tail &&
+        !rb->staged)
+        ringbufGoHome(rb);
+}
+
+/*
+ * Account for bytes added at rb's head by a producing operation: on
+ * the empty -> non-empty transition, flag rb as ready in its group.
+ */
+static void ringbufFilled(ringbuf_t rb, int was_empty)
+{
+    rb->idle = RINGBUF_IDLE_BUSY;
+    if (rb->group && was_empty && !ringbufIsEmpty(rb))
+        ringbufGroupMark(rb);
+}
+
+/*
+ * The number of bytes a consuming operation may take from rb's tail.
+ * None while any are in flight: those are at the tail, and only an
+ * acknowledgement (or a zerocopy completion) releases them.
+ */
+static size_t ringbufConsumable(const struct ringbuf_s *rb)
+{
+    return rb->inflight ? 0 : ringbufBytesUsed(rb);
+}
+
+size_t ringbufFindchr(const struct ringbuf_s *rb, int c, size_t offset)
+{
+    const uint8_t *bufend = ringbufEnd(rb);
+    size_t bytes_used = ringbufBytesUsed(rb);
+
+    /* at most two passes: one on each side of the wrap */
+    while (offset < bytes_used) {
+        const uint8_t *start = ringbufAdvancep(rb, rb->tail, offset);
+        #ifndef RINGBUF_NO_ASSERT
+        assert(bufend > start);
+        #endif /* !RINGBUF_NO_ASSERT */
+        size_t n = MIN(bufend - start, bytes_used - offset);
+        const uint8_t *found = memchr(start, c, n);
+        if (found)
+            return offset + (found - start);
+        offset += n;
+    }
+    return bytes_used;
+}
+
+int ringbufTransform(ringbuf_t rb, size_t offset, size_t len,
+                     void (*fn)(uint8_t *p, size_t n, size_t pos, void *arg),
+                     void *arg)
+{
+    struct iovec iov[2];
+    int niov = ringbufPeekRange(rb, offset, len, iov);
+    if (niov < 0)
+        return -1;
+
+    /* at most two passes: one on each side of the wrap */
+    size_t pos = 0;
+    for (int i = 0; i != niov; ++i) {
+        fn(iov[i].iov_base, iov[i].iov_len, pos, arg);
+        pos += iov[i].iov_len;
+    }
+    return 0;
+}
+
+/*
+ * XOR n bytes at p with the 4-byte key arg, starting at byte pos & 3
+ * of the key: 16 bytes at a time with SSE2, 8 at a time without, then
+ * byte by byte. Every chunk is a multiple of 4 bytes long, so one
+ * rotated copy of the key lines up with all of them.
+ */
+static void ringbufXorSegment(uint8_t *p, size_t n, size_t pos, void *arg)
+{
+    const uint8_t *key = arg;
+    uint8_t k[16];
+    for (int i = 0; i != 16; ++i)
+        k[i] = key[(pos + i) & 3];
+
+    size_t i = 0;
+#ifdef RINGBUF_SSE2
+    __m128i m = _mm_loadu_si128((const __m128i *) k);
+    for (; n - i >= 16; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *) (p + i));
+        _mm_storeu_si128((__m128i *) (p + i), _mm_xor_si128(v, m));
+    }
+#else
+    uint64_t m;
+    memcpy(&m, k, sizeof(m));
+    for (; n - i >= sizeof(m); i += sizeof(m)) {
+        uint64_t v;
+        memcpy(&v, p + i, sizeof(v));
+        v ^= m;
+        memcpy(p + i, &v, sizeof(v));
+    }
+#endif /* RINGBUF_SSE2 */
+    for (; i != n; ++i)
+        p[i] ^= k[i & 3];
+}
+
+int ringbufXorMask(ringbuf_t rb, size_t offset, size_t len, uint32_t mask)
+{
+    uint8_t key[4];
+    memcpy(key, &mask, sizeof(key));
+    return ringbufTransform(rb, offset, len, ringbufXorSegment, key);
 }
 
 size_t ringbufMemset(ringbuf_t dst, int c, size_t len)
 {
+    if (ringbufGrowFor(dst, len) < 0)
+        return 0;
     const uint8_t *bufend = ringbufEnd(dst);
     size_t nwritten = 0;
     size_t count = MIN(len, ringbufBufferSize(dst));
-    int overflow = count > ringbufBytesFree(dst);
+    int overflow = count > ringbufRoom(dst);
+    int was_empty = ringbufIsEmpty(dst);
+
+    /* overflowing would overwrite bytes still in flight */
+    if (overflow && dst->inflight)
+        return 0;
 
     while (nwritten != count) {
 
@@ -282,6 +743,7 @@ size_t ringbufMemset(ringbuf_t dst, int c, size_t len)
         assert(ringbufIsFull(dst));
         #endif /* !RINGBUF_NO_ASSERT */
     }
+    ringbufFilled(dst, was_empty);
 
     return nwritten;
 }
@@ -289,10 +751,17 @@ size_t ringbufMemset(ringbuf_t dst, int c, size_t len)
 void *ringbufMemcpyInto(ringbuf_t dst, const void *src, size_t count)
 {
     const uint8_t *u8src = src;
+    if (ringbufGrowFor(dst, count) < 0)
+        return 0;
     const uint8_t *bufend = ringbufEnd(dst);
-    int overflow = count > ringbufBytesFree(dst);
+    int overflow = count > ringbufRoom(dst);
+    int was_empty = ringbufIsEmpty(dst);
     size_t nread = 0;
 
+    /* overflowing would overwrite bytes still in flight */
+    if (overflow && dst->inflight)
+        return 0;
+
     while (nread != count) {
         /* don't copy beyond the end of the buffer */
         #ifndef RINGBUF_NO_ASSERT
@@ -314,14 +783,35 @@ void *ringbufMemcpyInto(ringbuf_t dst, const void *src, size_t count)
         assert(ringbufIsFull(dst));
         #endif /* !RINGBUF_NO_ASSERT */
     }
+    ringbufFilled(dst, was_empty);
 
     return dst->head;
 }
 
 ssize_t ringbufRead(int fd, ringbuf_t rb, size_t count)
 {
+    /*
+     * A lazy ring buffer grows, a doubling at a time, once it's full,
+     * and only overflows once it has grown all the way.
+     */
+    if (rb->size != rb->max_size) {
+        if (count && !ringbufRoom(rb) && ringbufGrowFor(rb, 1) < 0)
+            return -1;
+        if (rb->size != rb->max_size)
+            count = MIN(count, ringbufRoom(rb));
+    }
     const uint8_t *bufend = ringbufEnd(rb);
-    size_t nfree = ringbufBytesFree(rb);
+    size_t nfree = ringbufRoom(rb);
+
+    /* overflowing would overwrite bytes still in flight */
+    if (rb->inflight) {
+        if (count && !nfree) {
+            errno = ENOBUFS;
+            return -1;
+        }
+        count = MIN(count, nfree);
+    }
+    int was_empty = ringbufIsEmpty(rb);
 
     /* don't write beyond the end of the buffer */
     #ifndef RINGBUF_NO_ASSERT
@@ -346,6 +836,7 @@ ssize_t ringbufRead(int fd, ringbuf_t rb, size_t count)
             assert(ringbufIsFull(rb));
             #endif /* !RINGBUF_NO_ASSERT */
         }
+        ringbufFilled(rb, was_empty);
     }
 
     return n;
@@ -354,7 +845,7 @@ ssize_t ringbufRead(int fd, ringbuf_t rb, size_t count)
 void *ringbufMemcpyFrom(void *dst, ringbuf_t src, size_t count)
 {
     size_t bytes_used = ringbufBytesUsed(src);
-    if (count > bytes_used)
+    if (count > ringbufConsumable(src))
         return 0;
 
     uint8_t *u8dst = dst;
@@ -373,6 +864,7 @@ void *ringbufMemcpyFrom(void *dst, ringbuf_t src, size_t count)
         if (src->tail == bufend)
             src->tail = src->buf;
     }
+    ringbufReleased(src, count);
     #ifndef RINGBUF_NO_ASSERT
     assert(count + ringbufBytesUsed(src) == bytes_used);
     #endif /* !RINGBUF_NO_ASSERT */
@@ -382,7 +874,7 @@ void *ringbufMemcpyFrom(void *dst, ringbuf_t src, size_t count)
 ssize_t ringbufWrite(int fd, ringbuf_t rb, size_t count)
 {
     size_t bytes_used = ringbufBytesUsed(rb);
-    if (count > bytes_used)
+    if (count > ringbufConsumable(rb))
         return 0;
 
     const uint8_t *bufend = ringbufEnd(rb);
@@ -400,6 +892,7 @@ ssize_t ringbufWrite(int fd, ringbuf_t rb, size_t count)
         /* wrap? */
         if (rb->tail == bufend)
             rb->tail = rb->buf;
+        ringbufReleased(rb, n);
         #ifndef RINGBUF_NO_ASSERT
         assert(n + ringbufBytesUsed(rb) == bytes_used);
         #endif /* !RINGBUF_NO_ASSERT */
@@ -408,12 +901,186 @@ ssize_t ringbufWrite(int fd, ringbuf_t rb, size_t count)
     return n;
 }
 
+ssize_t ringbufWritevMany(int fd, ringbuf_t *rings, size_t n)
+{
+    struct iovec iov[IOV_MAX];
+    int niov = 0;
+    size_t i;
+
+    for (i = 0; i != n && niov != IOV_MAX; ++i) {
+        struct iovec seg[2];
+        int nseg = ringbufUsedIov(rings[i], ringbufConsumable(rings[i]), seg);
+        /* the last ring that fits may only get its first segment */
+        nseg = MIN(nseg, IOV_MAX - niov);
+        memcpy(iov + niov, seg, nseg * sizeof(struct iovec));
+        niov += nseg;
+    }
+    if (niov == 0)
+        return 0;
+
+    ssize_t written = writev(fd, iov, niov);
+    if (written <= 0)
+        return written;
+
+    /* hand the written bytes back to the rings' tails, in order */
+    size_t left = written;
+    int j = 0;
+    for (i = 0; left; ++i) {
+        #ifndef RINGBUF_NO_ASSERT
+        assert(i != n && j != niov);
+        #endif /* !RINGBUF_NO_ASSERT */
+        size_t used = ringbufConsumable(rings[i]);
+        size_t k = 0;
+        while (k != used && j != niov && left) {
+            size_t m = MIN(iov[j].iov_len, left);
+            k += m;
+            left -= m;
+            if (m != iov[j].iov_len)
+                break;
+            ++j;
+        }
+        ringbufAdvanceTail(rings[i], k);
+    }
+
+    return written;
+}
+
+int ringbufDump(int fd, const struct ringbuf_s *rb)
+{
+    /* one snapshot of head and tail, in case we interrupted a writer */
+    const uint8_t *tail = rb->tail;
+    const uint8_t *head = rb->head;
+    const uint8_t *bufend = ringbufEnd(rb);
+    struct iovec seg[2];
+    int nseg = 0;
+
+    if (head >= tail) {
+        seg[nseg].iov_base = (void *) tail;
+        seg[nseg++].iov_len = head - tail;
+    } else {
+        seg[nseg].iov_base = (void *) tail;
+        seg[nseg++].iov_len = bufend - tail;
+        seg[nseg].iov_base = rb->buf;
+        seg[nseg++].iov_len = head - rb->buf;
+    }
+
+    for (int i = 0; i != nseg; ++i) {
+        const uint8_t *p = seg[i].iov_base;
+        size_t left = seg[i].iov_len;
+        while (left) {
+            ssize_t n = write(fd, p, left);
+            if (n < 0) {
+                if (errno == EINTR)
+                    continue;
+                return -1;
+            }
+            p += n;
+            left -= n;
+        }
+    }
+    return 0;
+}
+
+#ifndef PATH_MAX
+#define PATH_MAX 4096
+#endif
+
+/*
+ * The flight recorder's state. The handlers only read it; it's only
+ * written with the signals blocked. A signal may arrive on any
+ * thread, so the ring is read and written atomically, and a handler
+ * loads it once.
+ */
+static ringbuf_t volatile ringbufDumpRing;
+static char ringbufDumpPath[PATH_MAX];
+static const int ringbufDumpSignals[] = { SIGUSR1, SIGSEGV, SIGBUS, SIGABRT };
+#define RINGBUF_DUMP_NSIGNALS \
+    (sizeof(ringbufDumpSignals) / sizeof(ringbufDumpSignals[0]))
+static struct sigaction ringbufDumpSaved[RINGBUF_DUMP_NSIGNALS];
+
+static void ringbufDumpHandler(int sig)
+{
+    int saved_errno = errno;
+    ringbuf_t rb = __atomic_load_n(&ringbufDumpRing, __ATOMIC_ACQUIRE);
+
+    if (rb) {
+        int fd = open(ringbufDumpPath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd >= 0) {
+            ringbufDump(fd, rb);
+            close(fd);
+        }
+    }
+    if (sig != SIGUSR1) {
+        /* SA_RESETHAND restored the default action */
+        raise(sig);
+    }
+    errno = saved_errno;
+}
+
+int ringbufDumpOnSignal(ringbuf_t rb, const char *path)
+{
+    sigset_t block, old;
+    size_t i;
+    int installed = __atomic_load_n(&ringbufDumpRing, __ATOMIC_ACQUIRE) != 0;
+
+    if (rb && strlen(path) >= sizeof(ringbufDumpPath)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+
+    sigemptyset(&block);
+    for (i = 0; i != RINGBUF_DUMP_NSIGNALS; ++i)
+        sigaddset(&block, ringbufDumpSignals[i]);
+    sigprocmask(SIG_BLOCK, &block, &old);
+
+    if (!rb) {
+        __atomic_store_n(&ringbufDumpRing, 0, __ATOMIC_RELEASE);
+        for (i = 0; installed && i != RINGBUF_DUMP_NSIGNALS; ++i)
+            sigaction(ringbufDumpSignals[i], &ringbufDumpSaved[i], 0);
+        sigprocmask(SIG_SETMASK, &old, 0);
+        return 0;
+    }
+
+    /* no handler dumps to a half-written path */
+    __atomic_store_n(&ringbufDumpRing, 0, __ATOMIC_RELEASE);
+    strcpy(ringbufDumpPath, path);
+    __atomic_store_n(&ringbufDumpRing, rb, __ATOMIC_RELEASE);
+    for (i = 0; !installed && i != RINGBUF_DUMP_NSIGNALS; ++i) {
+        struct sigaction sa;
+        memset(&sa, 0, sizeof(sa));
+        sa.sa_handler = ringbufDumpHandler;
+        sigemptyset(&sa.sa_mask);
+        sa.sa_flags = SA_ONSTACK;
+        if (ringbufDumpSignals[i] == SIGUSR1)
+            sa.sa_flags |= SA_RESTART;
+        else
+            sa.sa_flags |= SA_RESETHAND | SA_NODEFER;
+        if (sigaction(ringbufDumpSignals[i], &sa, &ringbufDumpSaved[i]) < 0) {
+            /* put back the ones we did install */
+            while (i--)
+                sigaction(ringbufDumpSignals[i], &ringbufDumpSaved[i], 0);
+            __atomic_store_n(&ringbufDumpRing, 0, __ATOMIC_RELEASE);
+            sigprocmask(SIG_SETMASK, &old, 0);
+            return -1;
+        }
+    }
+    sigprocmask(SIG_SETMASK, &old, 0);
+    return 0;
+}
+
 void *ringbufCopy(ringbuf_t dst, ringbuf_t src, size_t count)
 {
     size_t src_bytes_used = ringbufBytesUsed(src);
-    if (count > src_bytes_used)
+    if (count > ringbufConsumable(src))
+        return 0;
+    if (ringbufGrowFor(dst, count) < 0)
+        return 0;
+    int overflow = count > ringbufRoom(dst);
+    int was_empty = ringbufIsEmpty(dst);
+
+    /* overflowing would overwrite bytes still in flight */
+    if (overflow && dst->inflight)
         return 0;
-    int overflow = count > ringbufBytesFree(dst);
 
     const uint8_t *src_bufend = ringbufEnd(src);
     const uint8_t *dst_bufend = ringbufEnd(dst);
@@ -438,6 +1105,7 @@ void *ringbufCopy(ringbuf_t dst, ringbuf_t src, size_t count)
         if (dst->head == dst_bufend)
             dst->head = dst->buf;
     }
+    ringbufReleased(src, count);
     #ifndef RINGBUF_NO_ASSERT
     assert(count + ringbufBytesUsed(src) == src_bytes_used);
     #endif /* !RINGBUF_NO_ASSERT */
@@ -447,10 +1115,1076 @@ void *ringbufCopy(ringbuf_t dst, ringbuf_t src, size_t count)
         assert(ringbufIsFull(dst));
         #endif /* !RINGBUF_NO_ASSERT */
     }
+    ringbufFilled(dst, was_empty);
+
+    return dst->head;
+}
+
+void *ringbufMove(ringbuf_t dst, ringbuf_t src, size_t count)
+{
+    /*
+     * Only swap when nothing refers to either buffer's bytes by
+     * position: no in-flight sends or holds (the kernel or a reader
+     * may still be looking at src's memory), no staged transaction.
+     */
+    if (count != ringbufBytesUsed(src) || !ringbufIsEmpty(dst) ||
+        ringbufBufferSize(dst) != ringbufBufferSize(src) ||
+        src->lazy || dst->lazy || src->inflight || src->staged || dst->staged)
+        return ringbufCopy(dst, src, count);
+
+    uint8_t *buf = dst->buf;
+    dst->buf = src->buf;
+    dst->head = src->head;
+    dst->tail = src->tail;
+    src->buf = buf;
+    ringbufReset(src);
+    ringbufFilled(dst, 1);
 
     return dst->head;
 }
 
+/*
+ * Describe count logical bytes of the ring buffer, starting at p, as
+ * at most two contiguous iovecs (the second one only when the range
+ * wraps). Returns the number of iovecs filled in.
+ */
+static int ringbufIov(const struct ringbuf_s *rb, const uint8_t *p,
+                      size_t count, struct iovec iov[2])
+{
+    const uint8_t *bufend = ringbufEnd(rb);
+    size_t n = MIN(bufend - p, count);
+    int niov = 0;
+
+    if (n) {
+        iov[niov].iov_base = (void *) p;
+        iov[niov].iov_len = n;
+        ++niov;
+    }
+    if (count > n) {
+        iov[niov].iov_base = rb->buf;
+        iov[niov].iov_len = count - n;
+        ++niov;
+    }
+    return niov;
+}
+
+int ringbufFreeIov(const struct ringbuf_s *rb, size_t count,
+                   struct iovec iov[2])
+{
+    return ringbufIov(rb, rb->head, MIN(count, ringbufRoom(rb)), iov);
+}
+
+int ringbufUsedIov(const struct ringbuf_s *rb, size_t count,
+                   struct iovec iov[2])
+{
+    return ringbufIov(rb, rb->tail, MIN(count, ringbufBytesUsed(rb)), iov);
+}
+
+void ringbufAdvanceHead(ringbuf_t rb, size_t count)
+{
+    #ifndef RINGBUF_NO_ASSERT
+    assert(count <= ringbufRoom(rb));
+    #endif /* !RINGBUF_NO_ASSERT */
+    int was_empty = ringbufIsEmpty(rb);
+    rb->head = ringbufAdvancep(rb, rb->head, count);
+    ringbufFilled(rb, was_empty);
+}
+
+/*
+ * Release count bytes at rb's tail, in flight or not.
+ */
+static void ringbufDropTail(ringbuf_t rb, size_t count)
+{
+    #ifndef RINGBUF_NO_ASSERT
+    assert(count <= ringbufBytesUsed(rb));
+    #endif /* !RINGBUF_NO_ASSERT */
+    rb->tail = ringbufAdvancep(rb, rb->tail, count);
+    ringbufReleased(rb, count);
+}
+
+void ringbufAdvanceTail(ringbuf_t rb, size_t count)
+{
+    #ifndef RINGBUF_NO_ASSERT
+    assert(count <= ringbufConsumable(rb));
+    #endif /* !RINGBUF_NO_ASSERT */
+    ringbufDropTail(rb, count);
+}
+
+int ringbufPeekRange(const struct ringbuf_s *rb, size_t offset, size_t count,
+                     struct iovec iov[2])
+{
+    size_t bytes_used = ringbufBytesUsed(rb);
+    if (offset > bytes_used || count > bytes_used - offset)
+        return -1;
+    return ringbufIov(rb, ringbufAdvancep(rb, rb->tail, offset), count, iov);
+}
+
+int ringbufPeekUnsent(const struct ringbuf_s *rb, size_t count,
+                      struct iovec iov[2])
+{
+    size_t unsent = ringbufBytesUsed(rb) - rb->inflight;
+    return ringbufIov(rb, ringbufAdvancep(rb, rb->tail, rb->inflight),
+                      MIN(count, unsent), iov);
+}
+
+void ringbufMarkSent(ringbuf_t rb, size_t count)
+{
+    #ifndef RINGBUF_NO_ASSERT
+    assert(count <= ringbufBytesUsed(rb) - rb->inflight);
+    #endif /* !RINGBUF_NO_ASSERT */
+    rb->inflight += count;
+}
+
+size_t ringbufAck(ringbuf_t rb, size_t upto)
+{
+    /* zerocopy sends are released by ringbufZerocopyReap */
+    if (rb->pinned)
+        return 0;
+    size_t count = MIN(upto, rb->inflight);
+    ringbufDropTail(rb, count);
+    return count;
+}
+
+void *ringbufMemcpyFromHold(void *dst, ringbuf_t src, size_t count)
+{
+    uint8_t *u8dst = dst;
+    struct iovec iov[2];
+
+    if (count > ringbufBytesUsed(src) - src->inflight)
+        return 0;
+
+    int niov = ringbufPeekUnsent(src, count, iov);
+    for (int i = 0; i != niov; ++i) {
+        memcpy(u8dst, iov[i].iov_base, iov[i].iov_len);
+        u8dst += iov[i].iov_len;
+    }
+    ringbufMarkSent(src, count);
+    return ringbufAdvancep(src, src->tail, src->inflight);
+}
+
+size_t ringbufRelease(ringbuf_t rb)
+{
+    return ringbufAck(rb, rb->inflight);
+}
+
+size_t ringbufRewind(ringbuf_t rb)
+{
+    /* the kernel has zerocopy sends; they can't be taken back */
+    if (rb->pinned)
+        return 0;
+    size_t count = rb->inflight;
+    rb->inflight = 0;
+    return count;
+}
+
+void ringbufTxnBegin(ringbuf_t rb)
+{
+    rb->staged = 0;
+}
+
+int ringbufTxnReserve(const struct ringbuf_s *rb, size_t count,
+                      struct iovec iov[2])
+{
+    size_t unstaged = ringbufRoom(rb) - rb->staged;
+    return ringbufIov(rb, ringbufAdvancep(rb, rb->head, rb->staged),
+                      MIN(count, unstaged), iov);
+}
+
+void ringbufTxnAdvance(ringbuf_t rb, size_t count)
+{
+    #ifndef RINGBUF_NO_ASSERT
+    assert(count <= ringbufRoom(rb) - rb->staged);
+    #endif /* !RINGBUF_NO_ASSERT */
+    rb->staged += count;
+}
+
+int ringbufTxnAppend(ringbuf_t rb, const void *src, size_t count)
+{
+    const uint8_t *u8src = src;
+    struct iovec iov[2];
+
+    if (ringbufGrow(rb, count) < 0)
+        return -1;
+
+    int niov = ringbufTxnReserve(rb, count, iov);
+    for (int i = 0; i != niov; ++i) {
+        memcpy(iov[i].iov_base, u8src, iov[i].iov_len);
+        u8src += iov[i].iov_len;
+    }
+    rb->staged += count;
+    return 0;
+}
+
+size_t ringbufTxnCommit(ringbuf_t rb)
+{
+    size_t count = rb->staged;
+    int was_empty = ringbufIsEmpty(rb);
+    rb->head = ringbufAdvancep(rb, rb->head, count);
+    rb->staged = 0;
+    ringbufFilled(rb, was_empty);
+    return count;
+}
+
+void ringbufTxnAbort(ringbuf_t rb)
+{
+    rb->staged = 0;
+}
+
+/*
+ * Record mode. Each record is a header followed by its payload,
+ * never split across the wrap; records start at multiples of
+ * RINGBUF_REC_ALIGN bytes from the start of the internal buffer.
+ * When a record doesn't fit before the end of the buffer, the rest of
+ * the buffer is skipped: it holds a padding header if there is room
+ * for one, otherwise readers recognize it by its size alone.
+ */
+struct ringbuf_rec_t
+{
+    uint32_t stride;                    /* header to next header */
+    uint32_t len;                       /* payload bytes, or PAD */
+    socklen_t addrlen;
+    struct sockaddr_storage addr;
+};
+
+#define RINGBUF_REC_PAD UINT32_MAX
+#define RINGBUF_REC_ALIGN 8
+
+static size_t ringbufRecStride(size_t len)
+{
+    return (sizeof(struct ringbuf_rec_t) + len + RINGBUF_REC_ALIGN - 1) &
+        ~(size_t) (RINGBUF_REC_ALIGN - 1);
+}
+
+/*
+ * Given a record boundary p, skip the padding (if any) at the end of
+ * the internal buffer and return where the next record header is.
+ */
+static uint8_t *ringbufRecSkipPad(const struct ringbuf_s *rb, const uint8_t *p)
+{
+    const uint8_t *bufend = ringbufEnd(rb);
+    if ((size_t) (bufend - p) < sizeof(struct ringbuf_rec_t) ||
+        ((const struct ringbuf_rec_t *) p)->len == RINGBUF_REC_PAD)
+        return rb->buf;
+    return (uint8_t *) p;
+}
+
+/*
+ * Return the header of the oldest record in rb, or 0 if there is
+ * none.
+ */
+static struct ringbuf_rec_t *ringbufRecFirst(const struct ringbuf_s *rb)
+{
+    if (rb->tail == rb->head)
+        return 0;
+    uint8_t *p = ringbufRecSkipPad(rb, rb->tail);
+    if (p == rb->head)
+        return 0;
+    return (struct ringbuf_rec_t *) p;
+}
+
+/*
+ * Find room for a record of the given stride at *head, with *nfree
+ * bytes free after it, padding out the end of the internal buffer
+ * if necessary. On success, *head and *nfree are updated past the
+ * record and its slot is returned; on failure, returns 0.
+ *
+ * Neither rb's head pointer nor its contents past it are committed
+ * by this function, so callers can plan several slots and publish
+ * only some of them.
+ */
+static uint8_t *ringbufRecReserve(ringbuf_t rb, uint8_t **head,
+                                  size_t *nfree, size_t stride)
+{
+    const uint8_t *bufend = ringbufEnd(rb);
+    size_t room = bufend - *head;
+
+    if (room < stride) {
+        if (*nfree < room + stride)
+            return 0;
+        if (room >= sizeof(struct ringbuf_rec_t)) {
+            struct ringbuf_rec_t *pad = (struct ringbuf_rec_t *) *head;
+            pad->stride = room;
+            pad->len = RINGBUF_REC_PAD;
+        }
+        *nfree -= room;
+        *head = rb->buf;
+    } else if (*nfree < stride)
+        return 0;
+
+    uint8_t *slot = *head;
+    *nfree -= stride;
+    *head += stride;
+    if (*head == bufend)
+        *head = rb->buf;
+    return slot;
+}
+
+/*
+ * Return the record boundary following the record at p.
+ */
+static uint8_t *ringbufRecNextp(const struct ringbuf_s *rb, const uint8_t *p)
+{
+    uint8_t *next = (uint8_t *) p + ((const struct ringbuf_rec_t *) p)->stride;
+    return next == ringbufEnd(rb) ? rb->buf : next;
+}
+
+/*
+ * Release everything in rb from its tail pointer up to newtail.
+ */
+static void ringbufRecRelease(ringbuf_t rb, uint8_t *newtail)
+{
+    size_t n = newtail >= rb->tail ?
+        (size_t) (newtail - rb->tail) :
+        ringbufBufferSize(rb) - (rb->tail - newtail);
+    rb->tail = newtail;
+    ringbufReleased(rb, n);
+}
+
+int ringbufRecordPut(ringbuf_t rb, const void *data, size_t len,
+                     const struct sockaddr *addr, socklen_t addrlen)
+{
+    if (len >= RINGBUF_REC_PAD ||
+        addrlen > sizeof(struct sockaddr_storage))
+        return -1;
+
+    uint8_t *head = rb->head;
+    size_t nfree = ringbufRoom(rb);
+    size_t stride = ringbufRecStride(len);
+    struct ringbuf_rec_t *rec =
+        (struct ringbuf_rec_t *) ringbufRecReserve(rb, &head, &nfree, stride);
+    if (!rec)
+        return -1;
+
+    rec->stride = stride;
+    rec->len = len;
+    rec->addrlen = addr ? addrlen : 0;
+    if (rec->addrlen)
+        memcpy(&rec->addr, addr, addrlen);
+    memcpy(rec + 1, data, len);
+    int was_empty = ringbufIsEmpty(rb);
+    rb->head = head;
+    ringbufFilled(rb, was_empty);
+    return 0;
+}
+
+ssize_t ringbufRecordPeek(const struct ringbuf_s *rb, const void **data,
+                          const struct sockaddr **addr, socklen_t *addrlen)
+{
+    const struct ringbuf_rec_t *rec = ringbufRecFirst(rb);
+    if (!rec)
+        return -1;
+
+    if (data)
+        *data = rec + 1;
+    if (addr)
+        *addr = rec->addrlen ? (const struct sockaddr *) &rec->addr : 0;
+    if (addrlen)
+        *addrlen = rec->addrlen;
+    return rec->len;
+}
+
+int ringbufRecordPop(ringbuf_t rb)
+{
+    struct ringbuf_rec_t *rec = ringbufRecFirst(rb);
+    if (!rec)
+        return -1;
+
+    ringbufRecRelease(rb, ringbufRecNextp(rb, (uint8_t *) rec));
+    return 0;
+}
+
+#ifdef __linux__
+
+ssize_t ringbufSpliceOut(int fd, int pipefd[2], ringbuf_t rb, size_t count)
+{
+    size_t bytes_used = ringbufBytesUsed(rb);
+    if (count > ringbufConsumable(rb))
+        return 0;
+
+    /*
+     * Anything still sitting in the pipe was vmspliced by an earlier
+     * call and is the data at rb's tail: the pages are still
+     * referenced by the pipe, so forward those first instead of
+     * handing the same bytes to the kernel twice.
+     */
+    int inpipe = 0;
+    if (ioctl(pipefd[0], FIONREAD, &inpipe) == -1)
+        return -1;
+    rb->spliced = inpipe;
+    if ((size_t) inpipe < count) {
+        struct iovec iov[2];
+        int niov = ringbufIov(rb, ringbufAdvancep(rb, rb->tail, inpipe),
+                              count - inpipe, iov);
+        ssize_t n = vmsplice(pipefd[1], iov, niov, 0);
+        if (n > 0)
+            inpipe += n;
+        else if (inpipe == 0)
+            return n;
+        rb->spliced = inpipe;
+    }
+
+    /*
+     * Only bytes that have left the pipe are released; until then
+     * the tail stays pinned so the producer can't overwrite pages
+     * the kernel still references.
+     */
+    size_t ntosplice = MIN((size_t) inpipe, count);
+    size_t nspliced = 0;
+    while (nspliced != ntosplice) {
+        ssize_t n = splice(pipefd[0], 0, fd, 0, ntosplice - nspliced,
+                           SPLICE_F_MOVE);
+        if (n <= 0) {
+            if (nspliced == 0)
+                return n;
+            break;
+        }
+        nspliced += n;
+    }
+    rb->spliced -= nspliced;
+    rb->tail = ringbufAdvancep(rb, rb->tail, nspliced);
+    ringbufReleased(rb, nspliced);
+    #ifndef RINGBUF_NO_ASSERT
+    assert(nspliced + ringbufBytesUsed(rb) == bytes_used);
+    #endif /* !RINGBUF_NO_ASSERT */
+
+    return nspliced;
+}
+
+ssize_t ringbufSpliceIn(int fd, int pipefd[2], ringbuf_t rb, size_t count)
+{
+    if (count && !ringbufRoom(rb) && ringbufGrowFor(rb, 1) < 0)
+        return -1;
+    count = MIN(count, ringbufRoom(rb));
+    if (count == 0)
+        return 0;
+
+    /*
+     * Anything still sitting in the pipe was spliced in from fd by an
+     * earlier call that couldn't drain it all, and comes before
+     * anything fd has now: move that into rb first, without reading
+     * more from fd.
+     */
+    int inpipe = 0;
+    if (ioctl(pipefd[0], FIONREAD, &inpipe) == -1)
+        return -1;
+    ssize_t n = MIN((size_t) inpipe, count);
+    if (n == 0) {
+        n = splice(fd, 0, pipefd[1], 0, count, SPLICE_F_MOVE);
+        if (n <= 0)
+            return n;
+    }
+
+    /* drain exactly what was just spliced in, across the wrap */
+    int was_empty = ringbufIsEmpty(rb);
+    size_t nread = 0;
+    while (nread != (size_t) n) {
+        struct iovec iov[2];
+        int niov = ringbufIov(rb, rb->head, n - nread, iov);
+        ssize_t m = vmsplice(pipefd[0], iov, niov, 0);
+        if (m <= 0) {
+            /* the rest stays in the pipe, for the next call */
+            if (nread == 0)
+                return -1;
+            break;
+        }
+        rb->head = ringbufAdvancep(rb, rb->head, m);
+        nread += m;
+    }
+    ringbufFilled(rb, was_empty);
+
+    return nread;
+}
+
+/*
+ * MSG_ZEROCOPY bookkeeping: the lengths of the sendmsg(2) calls whose
+ * completion notifications haven't all been released yet, oldest
+ * first. The kernel numbers a socket's zerocopy sends 0, 1, 2...;
+ * first is the number of sends[start].
+ */
+#define RINGBUF_ZC_MAX 64
+
+struct ringbuf_zc_t
+{
+    uint32_t first;
+    unsigned start, count;
+    struct {
+        size_t len;
+        int done;
+    } sends[RINGBUF_ZC_MAX];
+};
+
+ssize_t ringbufSendZerocopy(int fd, ringbuf_t rb, size_t count)
+{
+    if (count == 0 || count > ringbufBytesUsed(rb) - rb->inflight)
+        return 0;
+
+    /* the kernel keeps reading the buffer after the call returns, so
+     * it may not move: grow a lazy ring buffer all the way first */
+    if (ringbufGrowFor(rb, ringbufBytesFree(rb)) < 0)
+        return -1;
+    if (!rb->zc) {
+        rb->zc = calloc(1, sizeof(struct ringbuf_zc_t));
+        if (!rb->zc)
+            return -1;
+    }
+    struct ringbuf_zc_t *zc = rb->zc;
+    if (zc->count == RINGBUF_ZC_MAX) {
+        errno = ENOBUFS;
+        return -1;
+    }
+
+    struct iovec iov[2];
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = ringbufPeekUnsent(rb, count, iov);
+    ssize_t n = sendmsg(fd, &msg, MSG_ZEROCOPY);
+    if (n > 0) {
+        unsigned i = (zc->start + zc->count) % RINGBUF_ZC_MAX;
+        zc->sends[i].len = n;
+        zc->sends[i].done = 0;
+        ++zc->count;
+        ringbufMarkSent(rb, n);
+        rb->pinned += n;
+    }
+
+    return n;
+}
+
+ssize_t ringbufZerocopyReap(int fd, ringbuf_t rb)
+{
+    struct ringbuf_zc_t *zc = rb->zc;
+    if (!zc)
+        return 0;
+
+    for (;;) {
+        char control[CMSG_SPACE(sizeof(struct sock_extended_err)) +
+                     CMSG_SPACE(sizeof(struct sockaddr_in6))];
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+
+        /* the error queue never blocks */
+        if (recvmsg(fd, &msg, MSG_ERRQUEUE) == -1) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                break;
+            return -1;
+        }
+
+        struct cmsghdr *cm;
+        for (cm = CMSG_FIRSTHDR(&msg); cm; cm = CMSG_NXTHDR(&msg, cm)) {
+            if (!((cm->cmsg_level == SOL_IP && cm->cmsg_type == IP_RECVERR) ||
+                  (cm->cmsg_level == SOL_IPV6 && cm->cmsg_type == IPV6_RECVERR)))
+                continue;
+            const struct sock_extended_err *serr =
+                (const struct sock_extended_err *) CMSG_DATA(cm);
+            if (serr->ee_errno != 0 || serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY)
+                continue;
+
+            /* [ee_info, ee_data] is an inclusive range of send numbers */
+            uint32_t id = serr->ee_info;
+            do {
+                uint32_t k = id - zc->first;
+                if (k < zc->count)
+                    zc->sends[(zc->start + k) % RINGBUF_ZC_MAX].done = 1;
+            } while (id++ != serr->ee_data);
+        }
+    }
+
+    /* release in FIFO order, so later completions wait for earlier ones */
+    size_t released = 0;
+    while (zc->count && zc->sends[zc->start].done) {
+        released += zc->sends[zc->start].len;
+        zc->start = (zc->start + 1) % RINGBUF_ZC_MAX;
+        --zc->count;
+        ++zc->first;
+    }
+    rb->pinned -= released;
+    ringbufDropTail(rb, released);
+
+    return released;
+}
+
+int ringbufRecvmmsg(int fd, ringbuf_t rb, size_t maxlen, unsigned n)
+{
+    struct mmsghdr msgs[RINGBUF_MMSG_MAX];
+    struct iovec iov[RINGBUF_MMSG_MAX];
+    struct ringbuf_rec_t *recs[RINGBUF_MMSG_MAX];
+    uint8_t *ends[RINGBUF_MMSG_MAX];
+
+    if (maxlen >= RINGBUF_REC_PAD)
+        return -1;
+
+    /* plan as many equally-sized slots as fit */
+    uint8_t *head = rb->head;
+    size_t nfree = ringbufRoom(rb);
+    size_t stride = ringbufRecStride(maxlen);
+    unsigned nslots = 0;
+    n = MIN(n, RINGBUF_MMSG_MAX);
+    while (nslots != n) {
+        uint8_t *slot = ringbufRecReserve(rb, &head, &nfree, stride);
+        if (!slot)
+            break;
+        recs[nslots] = (struct ringbuf_rec_t *) slot;
+        ends[nslots] = head;
+        memset(&msgs[nslots], 0, sizeof(struct mmsghdr));
+        iov[nslots].iov_base = recs[nslots] + 1;
+        iov[nslots].iov_len = maxlen;
+        msgs[nslots].msg_hdr.msg_name = &recs[nslots]->addr;
+        msgs[nslots].msg_hdr.msg_namelen = sizeof(struct sockaddr_storage);
+        msgs[nslots].msg_hdr.msg_iov = &iov[nslots];
+        msgs[nslots].msg_hdr.msg_iovlen = 1;
+        ++nslots;
+    }
+    if (nslots == 0)
+        return 0;
+
+    int m = recvmmsg(fd, msgs, nslots, MSG_WAITFORONE, 0);
+    if (m <= 0)
+        return m;
+
+    /* publish only the slots that were filled */
+    for (int i = 0; i != m; ++i) {
+        recs[i]->stride = stride;
+        recs[i]->len = msgs[i].msg_len;
+        recs[i]->addrlen = msgs[i].msg_hdr.msg_namelen;
+    }
+    int was_empty = ringbufIsEmpty(rb);
+    rb->head = ends[m - 1];
+    ringbufFilled(rb, was_empty);
+
+    return m;
+}
+
+int ringbufSendmmsg(int fd, ringbuf_t rb, unsigned n)
+{
+    struct mmsghdr msgs[RINGBUF_MMSG_MAX];
+    struct iovec iov[RINGBUF_MMSG_MAX];
+    uint8_t *ends[RINGBUF_MMSG_MAX];
+
+    uint8_t *p = rb->tail;
+    unsigned nrecs = 0;
+    n = MIN(n, RINGBUF_MMSG_MAX);
+    while (nrecs != n && p != rb->head) {
+        p = ringbufRecSkipPad(rb, p);
+        if (p == rb->head)
+            break;
+        struct ringbuf_rec_t *rec = (struct ringbuf_rec_t *) p;
+        memset(&msgs[nrecs], 0, sizeof(struct mmsghdr));
+        iov[nrecs].iov_base = rec + 1;
+        iov[nrecs].iov_len = rec->len;
+        msgs[nrecs].msg_hdr.msg_name = rec->addrlen ? &rec->addr : 0;
+        msgs[nrecs].msg_hdr.msg_namelen = rec->addrlen;
+        msgs[nrecs].msg_hdr.msg_iov = &iov[nrecs];
+        msgs[nrecs].msg_hdr.msg_iovlen = 1;
+        p = ringbufRecNextp(rb, p);
+        ends[nrecs] = p;
+        ++nrecs;
+    }
+    if (nrecs == 0)
+        return 0;
+
+    int m = sendmmsg(fd, msgs, nrecs, 0);
+    if (m > 0)
+        ringbufRecRelease(rb, ends[m - 1]);
+
+    return m;
+}
+
+#endif /* __linux__ */
+
+ringbuf_group_t ringbufGroupNew(size_t nslots)
+{
+    ringbuf_group_t g = malloc(sizeof(struct ringbuf_group_s));
+    if (!g)
+        return 0;
+    g->nslots = nslots;
+    g->scan = 0;
+    g->ready = calloc(RINGBUF_GROUP_WORDS(nslots), sizeof(uint64_t));
+    g->rings = calloc(nslots, sizeof(ringbuf_t));
+    g->free = malloc(nslots * sizeof(size_t));
+    if (!g->ready || !g->rings || !g->free) {
+        free(g->ready);
+        free(g->rings);
+        free(g->free);
+        free(g);
+        return 0;
+    }
+    /* lowest slots on top */
+    for (size_t i = 0; i != nslots; ++i)
+        g->free[i] = nslots - 1 - i;
+    g->nfree = nslots;
+    return g;
+}
+
+void ringbufGroupFree(ringbuf_group_t *g)
+{
+    #ifndef RINGBUF_NO_ASSERT
+    assert(g && *g);
+    #endif /* !RINGBUF_NO_ASSERT */
+    for (size_t i = 0; i != (*g)->nslots; ++i)
+        if ((*g)->rings[i])
+            (*g)->rings[i]->group = 0;
+    free((*g)->ready);
+    free((*g)->rings);
+    free((*g)->free);
+    free(*g);
+    *g = 0;
+}
+
+ssize_t ringbufGroupAdd(ringbuf_group_t g, ringbuf_t rb)
+{
+    #ifndef RINGBUF_NO_ASSERT
+    assert(!rb->group);
+    #endif /* !RINGBUF_NO_ASSERT */
+    if (!g->nfree)
+        return -1;
+    size_t i = g->free[--g->nfree];
+    g->rings[i] = rb;
+    rb->group = g;
+    rb->group_slot = i;
+    if (!ringbufIsEmpty(rb))
+        ringbufGroupMark(rb);
+    return i;
+}
+
+void ringbufGroupRemove(ringbuf_t rb)
+{
+    ringbuf_group_t g = rb->group;
+    #ifndef RINGBUF_NO_ASSERT
+    assert(g && g->rings[rb->group_slot] == rb);
+    #endif /* !RINGBUF_NO_ASSERT */
+    __atomic_fetch_and(&g->ready[rb->group_slot / 64],
+                       ~((uint64_t) 1 << (rb->group_slot % 64)),
+                       __ATOMIC_RELAXED);
+    g->rings[rb->group_slot] = 0;
+    g->free[g->nfree++] = rb->group_slot;
+    rb->group = 0;
+}
+
+void ringbufGroupMark(ringbuf_t rb)
+{
+    #ifndef RINGBUF_NO_ASSERT
+    assert(rb->group);
+    #endif /* !RINGBUF_NO_ASSERT */
+    __atomic_fetch_or(&rb->group->ready[rb->group_slot / 64],
+                      (uint64_t) 1 << (rb->group_slot % 64),
+                      __ATOMIC_RELEASE);
+}
+
+size_t ringbufGroupPoll(ringbuf_group_t g, ringbuf_t *ready, size_t max)
+{
+    size_t nwords = RINGBUF_GROUP_WORDS(g->nslots);
+    size_t start = g->scan;
+    size_t n = 0;
+
+    for (size_t k = 0; k != nwords && n != max; ++k) {
+        size_t w = start + k;
+        if (w >= nwords)
+            w -= nwords;
+        uint64_t bits = __atomic_load_n(&g->ready[w], __ATOMIC_ACQUIRE);
+        uint64_t claimed = 0;
+        while (bits && n != max) {
+            unsigned b = __builtin_ctzll(bits);
+            bits &= bits - 1;
+            claimed |= (uint64_t) 1 << b;
+            ready[n++] = g->rings[w * 64 + b];
+        }
+        if (claimed) {
+            __atomic_fetch_and(&g->ready[w], ~claimed, __ATOMIC_ACQ_REL);
+            /*
+             * A producer only marks a ring on the empty -> non-empty
+             * transition, so bytes added while the consumer still
+             * had some to drain would never be reported again. Keep
+             * a ring ready until a poll finds it empty.
+             */
+            uint64_t again = 0;
+            for (uint64_t c = claimed; c; c &= c - 1) {
+                unsigned b = __builtin_ctzll(c);
+                if (!ringbufIsEmpty(g->rings[w * 64 + b]))
+                    again |= (uint64_t) 1 << b;
+            }
+            if (again)
+                __atomic_fetch_or(&g->ready[w], again, __ATOMIC_RELEASE);
+        }
+        /* resume from a word with bits left, or the next one */
+        g->scan = bits ? w : w + 1;
+    }
+
+    return n;
+}
+
+ringbuf_arena_t ringbufArenaNew(size_t capacity, size_t maxlive)
+{
+    size_t nslots = 64;
+    while (nslots < maxlive)
+        nslots <<= 1;
+    ringbuf_arena_t arena = calloc(1, sizeof(struct ringbuf_arena_s));
+    if (!arena)
+        return 0;
+    arena->mask = nslots - 1;
+    arena->rb = ringbufNew(capacity);
+    arena->marks = calloc(nslots / 64, sizeof(uint64_t));
+    arena->ends = malloc(nslots * sizeof(uint8_t *));
+    if (!arena->rb || !arena->marks || !arena->ends) {
+        if (arena->rb)
+            ringbufFree(&arena->rb);
+        free(arena->marks);
+        free(arena->ends);
+        free(arena);
+        return 0;
+    }
+    return arena;
+}
+
+void ringbufArenaFree(ringbuf_arena_t *arena)
+{
+    #ifndef RINGBUF_NO_ASSERT
+    assert(arena && *arena);
+    #endif /* !RINGBUF_NO_ASSERT */
+    ringbufFree(&(*arena)->rb);
+    free((*arena)->marks);
+    free((*arena)->ends);
+    free(*arena);
+    *arena = 0;
+}
+
+/*
+ * Where an object of size bytes aligned to align would start if its
+ * header were placed at p.
+ */
+static uint8_t *ringbufArenaPlace(uint8_t *p, size_t align)
+{
+    uintptr_t a = (uintptr_t) p + RINGBUF_ARENA_HDR;
+    return p + ((a + align - 1) & ~(uintptr_t) (align - 1)) - (uintptr_t) p;
+}
+
+void *ringbufArenaAlloc(ringbuf_arena_t arena, size_t size, size_t align)
+{
+    ringbuf_t rb = arena->rb;
+    #ifndef RINGBUF_NO_ASSERT
+    assert(align && (align & (align - 1)) == 0);
+    #endif /* !RINGBUF_NO_ASSERT */
+    if (arena->next - arena->oldest > arena->mask)
+        return 0;
+
+    uint8_t *bufend = (uint8_t *) ringbufEnd(rb);
+    uint8_t *obj = ringbufArenaPlace(rb->head, align);
+    size_t room;
+    if (rb->head >= rb->tail) {
+        /* free space runs from head to the end of the buffer, then
+         * from its start to tail; head must not wrap onto tail, since
+         * head == tail means empty */
+        room = bufend - rb->head - (rb->tail == rb->buf);
+        if ((size_t) (obj - rb->head) + size > room) {
+            obj = ringbufArenaPlace(rb->buf, align);
+            room = rb->tail - rb->buf - 1;
+            if (rb->tail == rb->buf || (size_t) (obj - rb->buf) + size > room)
+                return 0;
+        }
+    } else {
+        room = rb->tail - rb->head - 1;
+        if ((size_t) (obj - rb->head) + size > room)
+            return 0;
+    }
+
+    uint32_t seq = arena->next++;
+    ++arena->live;
+    memcpy(obj - RINGBUF_ARENA_HDR, &seq, RINGBUF_ARENA_HDR);
+    rb->head = obj + size == bufend ? rb->buf : obj + size;
+    arena->ends[seq & arena->mask] = rb->head;
+    return obj;
+}
+
+void ringbufArenaRelease(ringbuf_arena_t arena, void *p)
+{
+    uint32_t seq;
+    memcpy(&seq, (uint8_t *) p - RINGBUF_ARENA_HDR, RINGBUF_ARENA_HDR);
+    uint32_t slot = seq & arena->mask;
+    #ifndef RINGBUF_NO_ASSERT
+    assert(seq - arena->oldest < arena->next - arena->oldest);
+    assert(!(arena->marks[slot / 64] & ((uint64_t) 1 << (slot % 64))));
+    #endif /* !RINGBUF_NO_ASSERT */
+    arena->marks[slot / 64] |= (uint64_t) 1 << (slot % 64);
+    --arena->live;
+
+    /* reclaim the released objects at the front, oldest first */
+    while (arena->oldest != arena->next) {
+        slot = arena->oldest & arena->mask;
+        uint64_t bit = (uint64_t) 1 << (slot % 64);
+        if (!(arena->marks[slot / 64] & bit))
+            break;
+        arena->marks[slot / 64] &= ~bit;
+        arena->rb->tail = arena->ends[slot];
+        ++arena->oldest;
+    }
+    /* with nothing live, start over with the whole buffer free */
+    if (arena->oldest == arena->next)
+        ringbufReset(arena->rb);
+}
+
+size_t ringbufArenaLive(const struct ringbuf_arena_s *arena)
+{
+    return arena->live;
+}
+
+size_t ringbufArenaBytesUsed(const struct ringbuf_arena_s *arena)
+{
+    return ringbufBytesUsed(arena->rb);
+}
+
+ringbuf_pool_t ringbufPoolNew(size_t nrings, size_t capacity)
+{
+    unsigned shift = 0;
+    while (((size_t) 1 << shift) < capacity)
+        ++shift;
+    if (shift > 31 || nrings > (UINT32_MAX >> shift)) {
+        errno = ENOMEM;
+        return 0;
+    }
+
+    ringbuf_pool_t pool = malloc(sizeof(struct ringbuf_pool_s));
+    if (!pool)
+        return 0;
+    pool->nrings = nrings;
+    pool->shift = shift;
+    pool->mask = ((uint32_t) 1 << shift) - 1;
+    pool->base = malloc(nrings << shift);
+    pool->rings = calloc(nrings, sizeof(struct ringbuf_compact_s));
+    if (!pool->base || !pool->rings) {
+        free(pool->base);
+        free(pool->rings);
+        free(pool);
+        return 0;
+    }
+    return pool;
+}
+
+void ringbufPoolFree(ringbuf_pool_t *pool)
+{
+    #ifndef RINGBUF_NO_ASSERT
+    assert(pool && *pool);
+    #endif /* !RINGBUF_NO_ASSERT */
+    free((*pool)->base);
+    free((*pool)->rings);
+    free(*pool);
+    *pool = 0;
+}
+
+size_t ringbufPoolRings(const struct ringbuf_pool_s *pool)
+{
+    return pool->nrings;
+}
+
+size_t ringbufPoolCapacity(const struct ringbuf_pool_s *pool)
+{
+    return (size_t) pool->mask + 1;
+}
+
+size_t ringbufPoolBytesUsed(const struct ringbuf_pool_s *pool, uint32_t ring)
+{
+    #ifndef RINGBUF_NO_ASSERT
+    assert(ring < pool->nrings);
+    #endif /* !RINGBUF_NO_ASSERT */
+    return pool->rings[ring].head - pool->rings[ring].tail;
+}
+
+size_t ringbufPoolBytesFree(const struct ringbuf_pool_s *pool, uint32_t ring)
+{
+    return ringbufPoolCapacity(pool) - ringbufPoolBytesUsed(pool, ring);
+}
+
+/*
+ * Describe count bytes of ring buffer ring, starting at counter pos,
+ * in up to two iovecs.
+ */
+static int ringbufPoolIov(const struct ringbuf_pool_s *pool, uint32_t ring,
+                          uint32_t pos, size_t count, struct iovec iov[2])
+{
+    uint8_t *buf = pool->base + ((size_t) ring << pool->shift);
+    size_t off = pos & pool->mask;
+    size_t n = MIN(pool->mask + 1 - off, count);
+    int niov = 0;
+
+    if (n) {
+        iov[niov].iov_base = buf + off;
+        iov[niov].iov_len = n;
+        ++niov;
+    }
+    if (count > n) {
+        iov[niov].iov_base = buf;
+        iov[niov].iov_len = count - n;
+        ++niov;
+    }
+    return niov;
+}
+
+size_t ringbufPoolMemcpyInto(ringbuf_pool_t pool, uint32_t ring,
+                             const void *src, size_t count)
+{
+    struct ringbuf_compact_s *r = &pool->rings[ring];
+    struct iovec iov[2];
+    const uint8_t *u8src = src;
+    #ifndef RINGBUF_NO_ASSERT
+    assert(ring < pool->nrings);
+    #endif /* !RINGBUF_NO_ASSERT */
+
+    count = MIN(count, ringbufPoolBytesFree(pool, ring));
+    int niov = ringbufPoolIov(pool, ring, r->head, count, iov);
+    for (int i = 0; i != niov; ++i) {
+        memcpy(iov[i].iov_base, u8src, iov[i].iov_len);
+        u8src += iov[i].iov_len;
+    }
+    r->head += count;
+    return count;
+}
+
+size_t ringbufPoolMemcpyFrom(void *dst, ringbuf_pool_t pool, uint32_t ring,
+                             size_t count)
+{
+    struct ringbuf_compact_s *r = &pool->rings[ring];
+    struct iovec iov[2];
+    uint8_t *u8dst = dst;
+    #ifndef RINGBUF_NO_ASSERT
+    assert(ring < pool->nrings);
+    #endif /* !RINGBUF_NO_ASSERT */
+
+    count = MIN(count, ringbufPoolBytesUsed(pool, ring));
+    int niov = ringbufPoolIov(pool, ring, r->tail, count, iov);
+    for (int i = 0; i != niov; ++i) {
+        memcpy(u8dst, iov[i].iov_base, iov[i].iov_len);
+        u8dst += iov[i].iov_len;
+    }
+    r->tail += count;
+    return count;
+}
+
+int ringbufPoolUsedIov(const struct ringbuf_pool_s *pool, uint32_t ring,
+                       struct iovec iov[2])
+{
+    return ringbufPoolIov(pool, ring, pool->rings[ring].tail,
+                          ringbufPoolBytesUsed(pool, ring), iov);
+}
+
+void ringbufPoolAdvanceTail(ringbuf_pool_t pool, uint32_t ring, size_t count)
+{
+    #ifndef RINGBUF_NO_ASSERT
+    assert(count <= ringbufPoolBytesUsed(pool, ring));
+    #endif /* !RINGBUF_NO_ASSERT */
+    pool->rings[ring].tail += count;
+}
+
+size_t ringbufPoolNonEmpty(const struct ringbuf_pool_s *pool, uint32_t start,
+                           uint32_t *rings, size_t max)
+{
+    size_t n = 0;
+    for (uint32_t i = start; i < pool->nrings && n != max; ++i)
+        if (pool->rings[i].head != pool->rings[i].tail)
+            rings[n++] = i;
+    return n;
+}
+
 size_t min(size_t a, size_t b) {
     if(a<b)
         return a;
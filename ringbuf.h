@@ -26,11 +26,69 @@
  * *from* the buffer (e.g., with ringbuf_write).
  */
 
+/*
+ * Real-time profile.
+ *
+ * Build ringbuf.c with -DRINGBUF_REALTIME for threads (audio, control
+ * loops) that must never block or run for an unbounded time. The
+ * profile implies RINGBUF_NO_ASSERT. The functions below then make no
+ * system calls, take no locks, allocate nothing, don't recurse and
+ * don't divide, and every loop in them makes a bounded number of
+ * passes, so each one is wait-free with a fixed worst case:
+ *
+ *   ringbufHead, ringbufTail, ringbufBytesUsed,       no loops
+ *   ringbufBytesFree, ringbufIsFull, ringbufIsEmpty,
+ *   ringbufUsedIov, ringbufFreeIov, ringbufReset,
+ *   ringbufAdvanceHead, ringbufAdvanceTail
+ *   ringbufFindchr, ringbufMemcpyFrom                 at most 2 passes
+ *   ringbufMemset, ringbufMemcpyInto                  2 passes (see below)
+ *
+ * Besides their own code, the functions that move the head or tail
+ * pointer make one call to a loop-free internal function that
+ * accounts for the move, and each pass makes one memcpy(3),
+ * memset(3) or memchr(3) call, linear in the bytes it handles. The
+ * two passes are one on each side of the wrap; ringbufMemcpyInto and
+ * ringbufMemset only make more when count is larger than the buffer
+ * (one per buffer size of count, plus one), so real-time callers
+ * should keep count within ringbufCapacity. The bound is stated by
+ * structure rather than in instructions, which depend on the
+ * compiler and target; objdump -d on a build with -DRINGBUF_REALTIME
+ * gives the figures for a particular one.
+ *
+ * This holds for ring buffers created with ringbufNew or ringbufBind.
+ * Lazy and small ring buffers (ringbufNewLazy, ringbufNewSmall)
+ * allocate as they grow, and a small one frees its separate buffer
+ * when it is drained or reset, so create ring buffers for a
+ * real-time thread with ringbufNew.
+ *
+ * Everything else (creating and freeing ring buffers, file descriptor
+ * I/O, groups, arenas) may allocate or make system calls, and belongs
+ * outside the real-time thread. ringbuf-bench rt reports the maximum
+ * and 99.999th percentile latency of the profile's copy operations.
+ */
+
 #include <stddef.h>
 #include <stdint.h>
+#include <sys/socket.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 
-typedef struct ringbuf_t *ringbuf_t;
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * In C the struct tag is ringbuf_t, as it always was, so existing
+ * "struct ringbuf_t" declarations keep compiling. C++ does not allow
+ * a typedef to share its name with a different struct tag, so C++
+ * sees the same struct as ringbuf_s. The functions have C linkage,
+ * so the two spellings name one type.
+ */
+#ifndef __cplusplus
+#define ringbuf_s ringbuf_t
+#endif
+
+typedef struct ringbuf_s *ringbuf_t;
 
 /*
  * Create a new ring buffer with the given capacity (usable
@@ -42,6 +100,74 @@ typedef struct ringbuf_t *ringbuf_t;
  */
 ringbuf_t ringbufNew(size_t capacity);
 
+/*
+ * Create a new ring buffer with the given capacity, but allocate only
+ * its control block: the internal buffer is allocated on the first
+ * write, small (64 bytes), and grows, by doubling, as the bytes held
+ * at once need more room, up to a buffer for the full capacity. When
+ * it grows, the bytes are copied to the start of the new buffer, so
+ * pointers previously obtained into the old one are invalidated. An
+ * idle lazy ring buffer (e.g., one per connection, most of them
+ * quiet) costs no more memory than its control block; ringbufTrim
+ * frees its buffer again.
+ *
+ * ringbufCapacity and ringbufBytesFree count the whole capacity,
+ * ringbufBufferSize only the buffer allocated so far. Writes through
+ * ringbufMemcpyInto, ringbufMemset, ringbufCopy, ringbufRead,
+ * ringbufSpliceIn and ringbufTxnAppend grow the buffer as needed;
+ * ringbufFreeIov and ringbufTxnReserve only describe the buffer as it
+ * is, so call ringbufReserve first. Record mode doesn't grow the
+ * buffer: reserve the room records need before using it. If growing
+ * runs out of memory, the write that needed the room fails, and the
+ * next one tries again: ringbufMemcpyInto, ringbufMemset and
+ * ringbufCopy write nothing and return 0, and ringbufRead,
+ * ringbufSpliceIn and ringbufSendZerocopy fail with errno set to
+ * ENOMEM. Growing frees the old buffer, so it is refused, in the same
+ * way but with errno set to EBUSY, while the kernel may still read
+ * it: while any bytes are in flight (see ringbufBytesInflight), or
+ * were handed to a pipe by ringbufSpliceOut and not yet forwarded.
+ *
+ * Returns the new ring buffer object, or 0 if there's not enough
+ * memory for its control block.
+ */
+ringbuf_t ringbufNewLazy(size_t capacity);
+
+/*
+ * Grow a lazy ring buffer's internal buffer, if need be, so it has
+ * room for count more bytes (after any staged by an open
+ * transaction) without overflowing.
+ *
+ * Returns 0 on success, or -1 if count bytes don't fit in the ring
+ * buffer's capacity, there isn't enough memory (errno is ENOMEM), or
+ * the buffer can't move yet (errno is EBUSY; see ringbufNewLazy).
+ */
+int ringbufReserve(ringbuf_t rb, size_t count);
+
+/*
+ * The size of a small ring buffer's inline buffer, in bytes.
+ */
+#define RINGBUF_SMALL 256
+
+/*
+ * Create a new ring buffer with the given capacity that keeps its
+ * bytes in a buffer of RINGBUF_SMALL bytes (or capacity + 1, if less)
+ * allocated together with its control block, for ring buffers that
+ * seldom hold more than RINGBUF_SMALL - 1 bytes at once. Writing to
+ * it never calls the allocator, and the bytes sit right after the
+ * control block, until they outgrow the inline buffer: then the ring
+ * buffer grows into a separate buffer, as a lazy ring buffer does
+ * (see ringbufNewLazy, which describes how growing works), and goes
+ * back to its inline buffer, freeing the separate one, as soon as
+ * it's drained (and has no open transaction).
+ *
+ * Moving to a new buffer, in either direction, invalidates pointers
+ * previously obtained into the old one.
+ *
+ * Returns the new ring buffer object, or 0 if there's not enough
+ * memory.
+ */
+ringbuf_t ringbufNewSmall(size_t capacity);
+
 /*
  * The size of the internal buffer, in bytes. One or more bytes may be
  * unusable in order to distinguish the "buffer full" state from the
@@ -71,14 +197,14 @@ ringbuf_t ringbufBind(ringbuf_t ringbuffer, uint8_t *bufferAddress);
  
  
  
-size_t ringbufBufferSize(const struct ringbuf_t *rb);
+size_t ringbufBufferSize(const struct ringbuf_s *rb);
 
 /*
  * Deallocate a ring buffer, and, as a side effect, set the pointer to
  * 0.
  */
 void
-ringbuf_free(ringbuf_t *rb);
+ringbufFree(ringbuf_t *rb);
 
 /*
  * Reset a ring buffer to its initial state (empty).
@@ -86,37 +212,101 @@ ringbuf_free(ringbuf_t *rb);
 void
 ringbufReset(ringbuf_t rb);
 
+/*
+ * Give the physical memory behind an empty ring buffer back to the
+ * kernel. If rb is empty (and has no open transaction), its head and
+ * tail pointers are moved back to the start of the buffer, and the
+ * whole pages of the buffer are released with madvise(2) MADV_FREE
+ * (or MADV_DONTNEED, where MADV_FREE isn't available); the kernel
+ * faults fresh pages back in on the next write that touches them. The
+ * ring buffer's logical state (empty, with the same capacity) does not
+ * change.
+ *
+ * Don't trim a ring buffer bound (with ringbufBind) to memory whose
+ * pages must stay put, e.g., a DMA area.
+ *
+ * A lazy ring buffer (see ringbufNewLazy) frees its whole buffer
+ * instead, and allocates a new one on its next write; a small ring
+ * buffer (see ringbufNewSmall) is already back in its inline buffer,
+ * and releases nothing.
+ *
+ * Returns the number of bytes released, 0 if rb isn't empty or has no
+ * whole pages, or -1 if madvise(2) failed (errno is set; the ring
+ * buffer is still reset to the start of its buffer).
+ */
+ssize_t ringbufTrim(ringbuf_t rb);
+
+/*
+ * Trim the ring buffers, out of the n in rings, that have been empty
+ * for at least idle time units. Call it periodically (e.g., once a
+ * minute, on each connection's ring buffers) with the current time in
+ * whatever units idle is in, e.g., seconds of CLOCK_MONOTONIC: a call
+ * that finds a ring buffer empty notes the time, and a later call
+ * trims it if it is still empty and hasn't been written to in between.
+ * Each idle period trims a ring buffer only once.
+ *
+ * Returns the number of ring buffers trimmed.
+ */
+size_t ringbufTrimIdle(ringbuf_t *rings, size_t n, uint64_t now,
+                       uint64_t idle);
+
 /*
  * The usable capacity of the ring buffer, in bytes. Note that this
  * value may be less than the ring buffer's internal buffer size, as
  * returned by ringbuf_buffer_size.
  */
-size_t ringbufCapacity(const struct ringbuf_t *rb);
+size_t ringbufCapacity(const struct ringbuf_s *rb);
 
 /*
  * The number of free/available bytes in the ring buffer. This value
  * is never larger than the ring buffer's usable capacity.
  */
-size_t ringbufBytesFree(const struct ringbuf_t *rb);
+size_t ringbufBytesFree(const struct ringbuf_s *rb);
 
 /*
  * The number of bytes currently being used in the ring buffer. This
  * value is never larger than the ring buffer's usable capacity.
  */
-size_t ringbufBytesUsed(const struct ringbuf_t *rb);
+size_t ringbufBytesUsed(const struct ringbuf_s *rb);
+
+/*
+ * The number of used bytes, counting from the ring buffer's tail
+ * pointer, that have been sent (e.g., with ringbufSendZerocopy) but
+ * not yet released. They still count as used, and the tail pointer
+ * stays pinned before them so they can't be overwritten. This value
+ * is never larger than the number of bytes used.
+ *
+ * Only an acknowledgement (ringbufAck, ringbufRelease) or, for
+ * zerocopy sends, ringbufZerocopyReap releases them. While any bytes
+ * are in flight, the functions that consume from the tail pointer
+ * (ringbufMemcpyFrom, ringbufWrite, ringbufCopy, ringbufSpliceOut)
+ * consume nothing, ringbufAdvanceTail must not be called, and the
+ * functions that can overflow a ring buffer (ringbufMemcpyInto,
+ * ringbufMemset, ringbufCopy, ringbufRead) don't: a write that
+ * doesn't fit in the free bytes writes nothing (ringbufRead reads
+ * only as much as fits, and fails with ENOBUFS if nothing does).
+ */
+size_t ringbufBytesInflight(const struct ringbuf_s *rb);
 
 
-int ringbufIsFull(const struct ringbuf_t *rb);
+int ringbufIsFull(const struct ringbuf_s *rb);
 
-int ringbufIsEmpty(const struct ringbuf_t *rb);
+int ringbufIsEmpty(const struct ringbuf_s *rb);
 
 
 /*
  * Const access to the head and tail pointers of the ring buffer.
  */
-const void *ringbufTail(const struct ringbuf_t *rb);
+const void *ringbufTail(const struct ringbuf_s *rb);
 
-const void *ringbufHead(const struct ringbuf_t *rb);
+const void *ringbufHead(const struct ringbuf_s *rb);
+
+/*
+ * Return a pointer to one-past-the-end of the ring buffer's
+ * contiguous buffer. You shouldn't normally need to use this function
+ * unless you're writing a new ringbuf_* function.
+ */
+const uint8_t *ringbufEnd(const struct ringbuf_s *rb);
 
 /*
  * Locate the first occurrence of character c (converted to an
@@ -129,7 +319,35 @@ const void *ringbufHead(const struct ringbuf_t *rb);
  * Note that the offset parameter and the returned offset are logical
  * offsets from the tail pointer, not necessarily linear offsets.
  */
-size_t ringbufFindchr(const struct ringbuf_t *rb, int c, size_t offset);
+size_t ringbufFindchr(const struct ringbuf_s *rb, int c, size_t offset);
+
+/*
+ * Transform len of rb's bytes in place, starting offset bytes from its
+ * tail pointer, without consuming them: call fn once for each
+ * contiguous segment of the range (at most two, one on each side of
+ * the wrap) with the segment's address p, its length n, the offset
+ * pos of its first byte from the start of the range, so a transform
+ * can carry state (e.g., a key's phase) across the wrap, and arg.
+ *
+ * Returns 0 on success, or -1 if the range extends past the used
+ * bytes (fn is not called).
+ */
+int ringbufTransform(ringbuf_t rb, size_t offset, size_t len,
+                     void (*fn)(uint8_t *p, size_t n, size_t pos, void *arg),
+                     void *arg);
+
+/*
+ * XOR len of rb's bytes in place, starting offset bytes from its tail
+ * pointer, with the repeating 4-byte key mask, as in WebSocket
+ * (RFC 6455) masking: byte i of the range is XORed with byte i % 4 of
+ * mask, in memory order (i.e., copy the key from the frame header
+ * into mask with memcpy). The key's phase carries across the wrap.
+ * Uses SSE2 where the compiler targets it.
+ *
+ * Returns 0 on success, or -1 if the range extends past the used
+ * bytes.
+ */
+int ringbufXorMask(ringbuf_t rb, size_t offset, size_t len, uint32_t mask);
 
 /*
  * Beginning at ring buffer dst's head pointer, fill the ring buffer
@@ -148,7 +366,9 @@ size_t ringbufFindchr(const struct ringbuf_t *rb, int c, size_t offset);
  * may be different than it was before the function was called.
  *
  * Returns the actual number of bytes written to dst: len, if
- * len < ringbuf_buffer_size(dst), else ringbuf_buffer_size(dst).
+ * len < ringbuf_buffer_size(dst), else ringbuf_buffer_size(dst); or
+ * 0 if it would overflow dst while bytes are in flight (see
+ * ringbufBytesInflight).
  */
 size_t ringbufMemset(ringbuf_t dst, int c, size_t len);
 
@@ -164,6 +384,10 @@ size_t ringbufMemset(ringbuf_t dst, int c, size_t len);
  * needed. However, note that, if calling the function results in an
  * overflow, the value of the ring buffer's tail pointer may be
  * different than it was before the function was called.
+ *
+ * While bytes are in flight (see ringbufBytesInflight), the ring
+ * buffer is never overflowed: if count is greater than the number of
+ * free bytes, nothing is copied, and the function returns 0.
  */
 void *ringbufMemcpyInto(ringbuf_t dst, const void *src, size_t count);
 
@@ -181,6 +405,10 @@ void *ringbufMemcpyInto(ringbuf_t dst, const void *src, size_t count);
  * fashion, as needed. However, note that, if calling the function
  * results in an overflow, the value of the ring buffer's tail pointer
  * may be different than it was before the function was called.
+ *
+ * While bytes are in flight (see ringbufBytesInflight), the ring
+ * buffer is never overflowed: at most the free bytes are read, and if
+ * there are none, the function fails with errno set to ENOBUFS.
  */
 ssize_t ringbufRead(int fd, ringbuf_t rb, size_t count);
 
@@ -197,7 +425,8 @@ ssize_t ringbufRead(int fd, ringbuf_t rb, size_t count);
  *
  * This function will *not* allow the ring buffer to underflow. If
  * count is greater than the number of bytes used in the ring buffer,
- * no bytes are copied, and the function will return 0.
+ * or any bytes are in flight (see ringbufBytesInflight), no bytes are
+ * copied, and the function will return 0.
  */
 
 void *ringbufMemcpyFrom(void *dst, ringbuf_t src, size_t count);
@@ -219,11 +448,73 @@ void *ringbufMemcpyFrom(void *dst, ringbuf_t src, size_t count);
  *
  * This function will *not* allow the ring buffer to underflow. If
  * count is greater than the number of bytes used in the ring buffer,
- * no bytes are written to the file descriptor, and the function will
- * return 0.
+ * or any bytes are in flight (see ringbufBytesInflight), no bytes are
+ * written to the file descriptor, and the function will return 0.
  */
 ssize_t ringbufWrite(int fd, ringbuf_t rb, size_t count);
 
+/*
+ * Write the used bytes of n ring buffers, in order, to fd with a
+ * single writev(2) call: one call instead of n calls to ringbufWrite
+ * when many ring buffers (e.g., one per session) drain into the same
+ * file descriptor. At most IOV_MAX segments are gathered; ring
+ * buffers that don't fit are left for the next call. Ring buffers
+ * with bytes in flight (see ringbufBytesInflight) are skipped.
+ *
+ * Each ring buffer's tail pointer is advanced by the number of its
+ * bytes that were written. A short write drains the ring buffers in
+ * order, so only one of them is ever left partially written.
+ *
+ * Returns the value returned by writev(2): the total number of bytes
+ * written, or < 0 if an error occurred (no tail pointer is moved).
+ * Returns 0 without calling writev(2) if there is nothing to write.
+ */
+ssize_t ringbufWritevMany(int fd, ringbuf_t *rings, size_t n);
+
+/*
+ * Write every used byte of the ring buffer rb, oldest first, to fd,
+ * without consuming them: rb is left unchanged. The bytes go out in
+ * at most two write(2) calls, one per side of the wrap (more only if
+ * write(2) returns a short count or is interrupted, in which case it
+ * is retried until everything is written).
+ *
+ * This function does not allocate memory or take locks and only
+ * calls write(2), so it is async-signal-safe: a signal handler may
+ * call it, as ringbufDumpOnSignal's does.
+ *
+ * Returns 0 on success, or -1 if write(2) failed (errno is set).
+ */
+int ringbufDump(int fd, const struct ringbuf_s *rb);
+
+/*
+ * Flight-recorder mode: keep the last ringbufCapacity(rb) bytes of
+ * trace events in rb, recording them with ringbufMemcpyInto and
+ * letting it overwrite the oldest data when rb is full (recording
+ * costs exactly that: no locks, no system calls), and dump rb to a
+ * file when something goes wrong.
+ *
+ * This installs signal handlers that create (or truncate) the file
+ * path and dump rb into it with ringbufDump: on SIGUSR1, after which
+ * the program carries on, and on SIGSEGV, SIGBUS and SIGABRT, after
+ * which the signal is re-raised with its default action, so the
+ * program still crashes (and dumps core) as it would have. The
+ * handlers run on the alternate signal stack, if the thread has one
+ * (see sigaltstack(2)), so they also work after a stack overflow.
+ *
+ * There is one flight recorder per process; installing another
+ * replaces it. Call ringbufDumpOnSignal(0, 0) before freeing rb to
+ * restore the signal handlers that were installed before.
+ *
+ * If a signal interrupts a recording in progress on the same thread,
+ * the dump may hold a partially-written last event, or (when the
+ * recording was overwriting old data) a few bytes of an event that
+ * was just overwritten.
+ *
+ * Returns 0 on success, or -1 if path is too long (errno is set to
+ * ENAMETOOLONG) or a handler couldn't be installed.
+ */
+int ringbufDumpOnSignal(ringbuf_t rb, const char *path);
+
 /*
  * Copy count bytes from ring buffer src, starting from its tail
  * pointer, into ring buffer dst. Returns dst's new head pointer after
@@ -244,11 +535,565 @@ ssize_t ringbufWrite(int fd, ringbuf_t rb, size_t count);
  * called.
  *
  * It is *not* possible to underflow src; if count is greater than the
- * number of bytes used in src, no bytes are copied, and the function
- * returns 0.
+ * number of bytes used in src, or any of src's bytes are in flight, no
+ * bytes are copied, and the function returns 0. Nor does it overflow
+ * dst while any of dst's bytes are in flight: then it copies nothing,
+ * and returns 0, if count is greater than dst's free bytes (see
+ * ringbufBytesInflight).
  */
 void *ringbufCopy(ringbuf_t dst, ringbuf_t src, size_t count);
 
+/*
+ * Like ringbufCopy, but when all of src's bytes are moved into an
+ * empty dst with the same buffer size, dst and src exchange internal
+ * buffers instead, in constant time: dst takes over src's buffer and
+ * pointers, and src is left empty, owning dst's old buffer. Otherwise
+ * (including while either ring buffer has a transaction open), the
+ * bytes are copied as by ringbufCopy, which copies nothing while src
+ * has sent or held bytes.
+ *
+ * Since buffers may change hands, dst and src must own their buffers
+ * the same way: both created by ringbufNew, or both bound to memory
+ * that outlives them with ringbufBind. (Lazy and small ring buffers
+ * always copy.) Pointers previously obtained into either buffer are
+ * invalidated.
+ */
+void *ringbufMove(ringbuf_t dst, ringbuf_t src, size_t count);
+
+/*
+ * Describe up to count of rb's free bytes, starting at its head
+ * pointer, as at most two iovecs: the second one is only used when
+ * the free space wraps around the end of the internal buffer. Never
+ * describes more than ringbufBytesFree(rb) bytes. Returns the
+ * number of iovecs filled in (0 if the ring buffer is full or count
+ * is 0).
+ *
+ * Together with ringbufAdvanceHead, this lets readv(2)-style
+ * operations fill the ring buffer in place.
+ */
+int ringbufFreeIov(const struct ringbuf_s *rb, size_t count,
+                   struct iovec iov[2]);
+
+/*
+ * Describe up to count of rb's used bytes, starting at its tail
+ * pointer, as at most two iovecs, in FIFO order. Never describes
+ * more than ringbufBytesUsed(rb) bytes. Returns the number of
+ * iovecs filled in.
+ *
+ * Together with ringbufAdvanceTail, this lets writev(2)-style
+ * operations drain the ring buffer in place.
+ */
+int ringbufUsedIov(const struct ringbuf_s *rb, size_t count,
+                   struct iovec iov[2]);
+
+/*
+ * Advance rb's head pointer by count bytes, making count bytes that
+ * were written into the segments returned by ringbufFreeIov
+ * available for reading. count must not exceed the number of free
+ * bytes; this function never overflows the ring buffer.
+ */
+void ringbufAdvanceHead(ringbuf_t rb, size_t count);
+
+/*
+ * Advance rb's tail pointer by count bytes, releasing them. count
+ * must not exceed the number of used bytes, and no bytes may be in
+ * flight (see ringbufBytesInflight): those are only released by an
+ * acknowledgement.
+ */
+void ringbufAdvanceTail(ringbuf_t rb, size_t count);
+
+/*
+ * Acknowledged sending. For retransmission buffers, a ring buffer
+ * has three cursors: the head pointer (where new data is appended),
+ * the send cursor, and the tail pointer, which doubles as the
+ * acknowledgement cursor. Bytes between the tail pointer and the send
+ * cursor have been sent but not acknowledged (see
+ * ringbufBytesInflight); they stay in the ring buffer, where they can
+ * be resent, until they are acknowledged. None of these functions
+ * copy data, and all of them take constant time.
+ */
+
+/*
+ * Describe count bytes of rb, starting offset bytes after its tail
+ * pointer, as at most two iovecs, without consuming them: e.g., to
+ * resend an unacknowledged range. Returns the number of iovecs filled
+ * in, or -1 if the range extends past the used bytes.
+ */
+int ringbufPeekRange(const struct ringbuf_s *rb, size_t offset, size_t count,
+                     struct iovec iov[2]);
+
+/*
+ * Describe up to count bytes that haven't been sent yet, starting at
+ * rb's send cursor, as at most two iovecs. Returns the number of
+ * iovecs filled in (0 if everything has been sent).
+ */
+int ringbufPeekUnsent(const struct ringbuf_s *rb, size_t count,
+                      struct iovec iov[2]);
+
+/*
+ * Advance rb's send cursor by count bytes, e.g. after the segments
+ * returned by ringbufPeekUnsent have been transmitted. count must not
+ * exceed the number of unsent bytes.
+ */
+void ringbufMarkSent(ringbuf_t rb, size_t count);
+
+/*
+ * Acknowledge the sent bytes up to upto bytes after rb's tail
+ * pointer: they are released, and the tail pointer advances past
+ * them. Bytes that haven't been sent can't be acknowledged, so upto
+ * is clamped to the number of bytes in flight. Bytes sent with
+ * ringbufSendZerocopy are only released by ringbufZerocopyReap, so
+ * nothing is acknowledged while any of those are awaiting completion.
+ * Returns the number of bytes released.
+ */
+size_t ringbufAck(ringbuf_t rb, size_t upto);
+
+/*
+ * Two-phase consumption. The send cursor also serves consumers that
+ * must not lose data if they fail halfway through a batch: they read
+ * from the send cursor (with ringbufPeekUnsent and ringbufMarkSent,
+ * without copying, or with ringbufMemcpyFromHold), process the data,
+ * and only then release it with ringbufRelease. If processing fails,
+ * ringbufRewind moves the read cursor back to the last release
+ * point, and the same bytes can be peeked at again.
+ */
+
+/*
+ * Like ringbufMemcpyFrom, but the count bytes are copied from rb's
+ * read (send) cursor, and only that cursor advances: the bytes stay
+ * in the ring buffer until released. Returns the new read cursor, or
+ * 0 (copying nothing) if count is greater than the number of unread
+ * bytes.
+ */
+void *ringbufMemcpyFromHold(void *dst, ringbuf_t src, size_t count);
+
+/*
+ * Release everything read so far: advance rb's tail pointer to its
+ * read cursor. Returns the number of bytes released.
+ */
+size_t ringbufRelease(ringbuf_t rb);
+
+/*
+ * Move rb's read cursor back to its tail pointer, so the bytes read
+ * since the last release can be read again. Returns the number of
+ * bytes rewound (none while zerocopy sends are awaiting completion).
+ */
+size_t ringbufRewind(ringbuf_t rb);
+
+/*
+ * Transactional writes. A producer can build a multi-part message
+ * (e.g., a frame header followed by its body) directly in the ring
+ * buffer's free space, behind a private write cursor, and publish it
+ * all at once: the head pointer only moves when the transaction is
+ * committed, so readers never see a partial message, and aborting
+ * costs nothing. Transactions never overflow the ring buffer.
+ *
+ * There is at most one transaction per ring buffer; while it is
+ * open, don't write to the ring buffer by other means, which would
+ * overwrite the staged bytes.
+ */
+
+/*
+ * Start a transaction on rb, discarding any uncommitted one.
+ */
+void ringbufTxnBegin(ringbuf_t rb);
+
+/*
+ * Append count bytes from src to the open transaction. Returns 0 on
+ * success, or -1 if there isn't enough free space, in which case
+ * nothing is appended and the transaction stays open (typically the
+ * caller aborts it).
+ */
+int ringbufTxnAppend(ringbuf_t rb, const void *src, size_t count);
+
+/*
+ * Describe up to count free bytes following the open transaction's
+ * staged bytes as at most two iovecs, so an encoder can write into
+ * the ring buffer in place; then call ringbufTxnAdvance with the
+ * number of bytes actually written. Returns the number of iovecs
+ * filled in.
+ */
+int ringbufTxnReserve(const struct ringbuf_s *rb, size_t count,
+                      struct iovec iov[2]);
+
+/*
+ * Add count bytes, written into the segments returned by
+ * ringbufTxnReserve, to the open transaction.
+ */
+void ringbufTxnAdvance(ringbuf_t rb, size_t count);
+
+/*
+ * Publish everything staged by the open transaction by advancing
+ * rb's head pointer, and close the transaction. Returns the number of
+ * bytes committed.
+ */
+size_t ringbufTxnCommit(ringbuf_t rb);
+
+/*
+ * Discard everything staged by the open transaction and close it.
+ */
+void ringbufTxnAbort(ringbuf_t rb);
+
+/*
+ * Record mode. A ring buffer can hold a FIFO of datagram-style
+ * records instead of a byte stream: each record keeps its payload
+ * contiguous (records never straddle the wrap), along with its
+ * length and an optional socket address. A ring buffer used in record
+ * mode must only be written and read with the ringbufRecord*,
+ * ringbufRecvmmsg and ringbufSendmmsg functions (plus ringbufReset
+ * and the size/usage queries), since the records carry a header and
+ * padding that byte-oriented functions know nothing about.
+ *
+ * Each record costs a header (including a struct sockaddr_storage)
+ * on top of its payload, rounded up to a multiple of 8 bytes.
+ */
+
+/*
+ * Append a record with len bytes of payload copied from data, and
+ * the address addr (addrlen bytes; addr may be 0 for none). Record
+ * mode never overflows the ring buffer.
+ *
+ * Returns 0 on success, or -1 if there isn't enough free space.
+ */
+int ringbufRecordPut(ringbuf_t rb, const void *data, size_t len,
+                     const struct sockaddr *addr, socklen_t addrlen);
+
+/*
+ * Look at the oldest record without copying or releasing it. Any of
+ * data, addr and addrlen may be 0; otherwise they're set to the
+ * record's payload, address (0 if it has none) and address length.
+ * The pointers remain valid until the record is popped.
+ *
+ * Returns the record's payload length, or -1 if there are no
+ * records.
+ */
+ssize_t ringbufRecordPeek(const struct ringbuf_s *rb, const void **data,
+                          const struct sockaddr **addr, socklen_t *addrlen);
+
+/*
+ * Release the oldest record. Returns 0 on success, or -1 if there
+ * are no records.
+ */
+int ringbufRecordPop(ringbuf_t rb);
+
+#ifdef __linux__
+/*
+ * Forward count bytes from ring buffer rb, starting at its tail
+ * pointer, to the file descriptor fd without copying them through
+ * user space: the ring buffer's readable segments are vmsplice(2)d
+ * into the pipe pipefd, then splice(2)d from the pipe to fd. pipefd
+ * must be a pipe dedicated to rb, as returned by pipe(2).
+ *
+ * Returns the number of bytes that reached fd, or the (<= 0) value
+ * returned by vmsplice(2) or splice(2) if nothing did. Only those
+ * bytes are released from rb. Bytes that were handed to the pipe but
+ * not yet forwarded (e.g., because fd is non-blocking and full) stay
+ * in the ring buffer with its tail pointer pinned, since the pipe
+ * still references their pages; the next call forwards them first.
+ *
+ * Note that once the pipe is drained the kernel reports nothing
+ * further about the pages; a socket's network stack may keep
+ * referencing them until transmission completes.
+ *
+ * Like ringbufWrite, this function will *not* allow the ring buffer
+ * to underflow: if count is greater than the number of bytes used in
+ * rb, or any bytes are in flight, nothing is forwarded and the
+ * function returns 0.
+ */
+ssize_t ringbufSpliceOut(int fd, int pipefd[2], ringbuf_t rb, size_t count);
+
+/*
+ * The reverse of ringbufSpliceOut: splice(2) up to count bytes from
+ * fd into the pipe pipefd, then vmsplice(2) them from the pipe
+ * into rb's free segments, advancing its head pointer. Both free
+ * segments are filled if the data wraps.
+ *
+ * Unlike ringbufRead, this function never overflows the ring
+ * buffer: count is clamped to the number of free bytes in rb.
+ * Returns the number of bytes moved into rb, or the (<= 0) value
+ * returned by splice(2), or -1 if vmsplice(2) failed before moving
+ * anything. Bytes a call leaves in the pipe (if vmsplice(2) fails
+ * part way) are moved into rb by the next call, before anything more
+ * is read from fd.
+ */
+ssize_t ringbufSpliceIn(int fd, int pipefd[2], ringbuf_t rb, size_t count);
+
+/*
+ * Send up to count bytes that have not been sent yet (i.e., starting
+ * ringbufBytesInflight(rb) bytes after rb's tail pointer) on socket
+ * fd with sendmsg(2) and MSG_ZEROCOPY, straight from the ring
+ * buffer's memory. Both used segments are sent if the data wraps.
+ * The caller must have enabled SO_ZEROCOPY on fd, and must not send
+ * zerocopy data on fd by any other means, since completions are
+ * matched to sends by the kernel's per-socket send counter.
+ *
+ * The bytes sent become in flight: they are not released, and the
+ * tail pointer does not move, until ringbufZerocopyReap sees the
+ * kernel's completion notification for them. At most 64 sends may be
+ * awaiting completion; beyond that, the function fails with errno
+ * set to ENOBUFS.
+ *
+ * Returns the value returned by sendmsg(2). Like ringbufWrite, this
+ * function will *not* send more than is available: if count is
+ * greater than the number of unsent bytes, nothing is sent and the
+ * function returns 0.
+ */
+ssize_t ringbufSendZerocopy(int fd, ringbuf_t rb, size_t count);
+
+/*
+ * Drain the MSG_ZEROCOPY completion notifications queued on fd's
+ * error queue (see recvmsg(2), MSG_ERRQUEUE) without blocking, and
+ * release every send that has completed, in order, by advancing rb's
+ * tail pointer. Call it when poll(2) reports POLLERR on fd.
+ *
+ * Returns the number of bytes released, or -1 if reading the error
+ * queue failed (errno is set).
+ */
+ssize_t ringbufZerocopyReap(int fd, ringbuf_t rb);
+
+/*
+ * The largest number of datagrams ringbufRecvmmsg and ringbufSendmmsg
+ * handle per call.
+ */
+#define RINGBUF_MMSG_MAX 64
+
+/*
+ * Receive up to n datagrams (at most RINGBUF_MMSG_MAX) from socket fd
+ * with a single recvmmsg(2) call, directly into record slots of rb:
+ * each slot has room for maxlen bytes of payload, and datagrams
+ * larger than that are truncated, as with recv(2). The sender's
+ * address is stored with each record. Only as many slots as fit in
+ * rb's free space are offered to the kernel.
+ *
+ * Since slots are laid out before the datagrams' sizes are known,
+ * every record received this way occupies a full slot; choose maxlen
+ * accordingly.
+ *
+ * Returns the number of records appended, 0 if there was no room,
+ * or -1 on failure (errno is set, as by recvmmsg(2)).
+ */
+int ringbufRecvmmsg(int fd, ringbuf_t rb, size_t maxlen, unsigned n);
+
+/*
+ * Send up to n of the oldest records in rb (at most
+ * RINGBUF_MMSG_MAX) with a single sendmmsg(2) call, each to its
+ * stored address (records without one are sent to fd's connected
+ * peer), and release the ones that were sent.
+ *
+ * Returns the number of records sent, 0 if there were none, or -1 on
+ * failure (errno is set, as by sendmmsg(2)).
+ */
+int ringbufSendmmsg(int fd, ringbuf_t rb, unsigned n);
+#endif /* __linux__ */
+
+/*
+ * Ring groups.
+ *
+ * Polling thousands of ring buffers with ringbufIsEmpty costs O(number
+ * of ring buffers) per pass, however few of them have data. A ring
+ * group keeps a readiness bitmap with one bit per member: every
+ * function that adds bytes to a member sets its bit when the member
+ * goes from empty to non-empty, and ringbufGroupPoll finds the set
+ * bits a 64-bit word at a time with count-trailing-zeros scans, so a
+ * poll costs O(number of ready ring buffers), plus one load per 64
+ * members.
+ *
+ * Bits are set and claimed atomically, so producers may mark members
+ * ready while a consumer polls from another thread; the ring buffers
+ * themselves are no more thread-safe than before. Membership changes
+ * (add, remove, free) must not race with polling.
+ */
+typedef struct ringbuf_group_s *ringbuf_group_t;
+
+/*
+ * Create a ring group with room for nslots members. Returns 0 if
+ * there isn't enough memory.
+ */
+ringbuf_group_t ringbufGroupNew(size_t nslots);
+
+/*
+ * Deallocate a ring group, and, as a side effect, set the pointer to
+ * 0. Its members are not freed; they just stop being members.
+ */
+void ringbufGroupFree(ringbuf_group_t *g);
+
+/*
+ * Add rb, which must not already be in a group, to a free slot of g:
+ * the one freed most recently, or else the lowest one never used. rb
+ * is marked ready at once if it is not empty. Takes O(1) time.
+ *
+ * Returns the slot number, or -1 if g is full.
+ */
+ssize_t ringbufGroupAdd(ringbuf_group_t g, ringbuf_t rb);
+
+/*
+ * Remove rb from its group. ringbufFree does this automatically.
+ */
+void ringbufGroupRemove(ringbuf_t rb);
+
+/*
+ * Mark rb, which must be in a group, as ready. The functions that add
+ * bytes do this on the empty -> non-empty transition, and
+ * ringbufGroupPoll keeps members that are not empty ready; call it
+ * to have ringbufGroupPoll return rb regardless.
+ */
+void ringbufGroupMark(ringbuf_t rb);
+
+/*
+ * Store up to max ready members of g in ready, and clear the ready
+ * bits of those that are empty. A member that is not empty stays
+ * ready, since bytes added to it from now on don't make it go from
+ * empty to non-empty: the caller drains it, and the next poll that
+ * returns it, empty, clears its bit. Successive calls resume
+ * scanning where the last one stopped, so no member is starved when
+ * more than max are ready.
+ *
+ * Returns the number of ring buffers stored.
+ */
+size_t ringbufGroupPoll(ringbuf_group_t g, ringbuf_t *ready, size_t max);
+
+/*
+ * FIFO arenas.
+ *
+ * Objects that are allocated per message and freed in roughly the
+ * order they arrived can be carved out of a ring buffer instead of
+ * malloc'd. An arena allocation bumps the ring buffer's head pointer
+ * (after aligning it, and moving it to the start of the buffer if the
+ * object wouldn't fit before the end: an object is never split across
+ * the wrap); releasing the oldest live object moves the tail pointer
+ * past it. An object released before older ones is only marked, in a
+ * bitmap with one bit per live object, and its space is reclaimed
+ * when the objects before it have been released, too.
+ *
+ * Each object takes its size, plus a 4-byte header, plus padding for
+ * its alignment. Like ring buffers, arenas are not thread-safe.
+ */
+typedef struct ringbuf_arena_s *ringbuf_arena_t;
+
+/*
+ * Create an arena of capacity bytes that can hold up to maxlive
+ * objects at once (rounded up to a power of two, at least 64). Returns
+ * 0 if there isn't enough memory.
+ */
+ringbuf_arena_t ringbufArenaNew(size_t capacity, size_t maxlive);
+
+/*
+ * Deallocate an arena, and, as a side effect, set the pointer to 0.
+ * Any objects still live are freed with it.
+ */
+void ringbufArenaFree(ringbuf_arena_t *arena);
+
+/*
+ * Allocate size bytes aligned to align (a power of two) from arena.
+ *
+ * Returns the object, or 0 if the arena doesn't have room for it (in
+ * one contiguous piece) or already holds maxlive objects.
+ */
+void *ringbufArenaAlloc(ringbuf_arena_t arena, size_t size, size_t align);
+
+/*
+ * Release an object allocated from arena. Releasing the oldest live
+ * object makes its space (and that of any younger objects already
+ * released) available again at once; releasing any other object
+ * defers that until the objects before it have been released.
+ */
+void ringbufArenaRelease(ringbuf_arena_t arena, void *p);
+
+/*
+ * The number of objects allocated but not yet released.
+ */
+size_t ringbufArenaLive(const struct ringbuf_arena_s *arena);
+
+/*
+ * The number of bytes taken up by live objects, released objects whose
+ * space hasn't been reclaimed yet, headers, padding, and space skipped
+ * at the end of the buffer by allocations that wrapped.
+ */
+size_t ringbufArenaBytesUsed(const struct ringbuf_arena_s *arena);
+
+/*
+ * Ring pools.
+ *
+ * Each ringbuf_t is a separate heap object of four pointers and
+ * sizes, so with millions of small ring buffers (e.g., one per
+ * session), their metadata alone is a large cache footprint. A ring
+ * pool holds many ring buffers of the same capacity in one block of
+ * memory, and keeps each one's state in an 8-byte control block: its
+ * head and tail counters. A ring buffer is identified by its index in
+ * the pool; its buffer lives at a 32-bit offset from the pool's base
+ * that is computed from the index, so it doesn't need storing.
+ * Control blocks are packed in an array, so scanning the occupancy of
+ * many ring buffers touches 8 of them per 64-byte cache line.
+ *
+ * The capacity is rounded up to a power of two, and all of it is
+ * usable. Unlike ringbufMemcpyInto, ringbufPoolMemcpyInto never
+ * overflows. Like ring buffers, pools are not thread-safe.
+ */
+typedef struct ringbuf_pool_s *ringbuf_pool_t;
+
+/*
+ * Create a pool of nrings empty ring buffers with at least capacity
+ * bytes each. The buffers must fit in 4 GiB altogether.
+ *
+ * Returns the new pool, or 0 if it wouldn't fit in 4 GiB or there
+ * isn't enough memory.
+ */
+ringbuf_pool_t ringbufPoolNew(size_t nrings, size_t capacity);
+
+/*
+ * Deallocate a pool and all its ring buffers, and, as a side effect,
+ * set the pointer to 0.
+ */
+void ringbufPoolFree(ringbuf_pool_t *pool);
+
+/*
+ * The number of ring buffers in the pool, and their (rounded up)
+ * capacity.
+ */
+size_t ringbufPoolRings(const struct ringbuf_pool_s *pool);
+size_t ringbufPoolCapacity(const struct ringbuf_pool_s *pool);
+
+/*
+ * The number of used and free bytes in ring buffer ring of the pool.
+ */
+size_t ringbufPoolBytesUsed(const struct ringbuf_pool_s *pool, uint32_t ring);
+size_t ringbufPoolBytesFree(const struct ringbuf_pool_s *pool, uint32_t ring);
+
+/*
+ * Copy as much of the count bytes at src into ring buffer ring as
+ * fits. Returns the number of bytes copied.
+ */
+size_t ringbufPoolMemcpyInto(ringbuf_pool_t pool, uint32_t ring,
+                             const void *src, size_t count);
+
+/*
+ * Copy up to count bytes out of ring buffer ring into dst, consuming
+ * them. Returns the number of bytes copied.
+ */
+size_t ringbufPoolMemcpyFrom(void *dst, ringbuf_pool_t pool, uint32_t ring,
+                             size_t count);
+
+/*
+ * Describe the used bytes of ring buffer ring, oldest first, in up to
+ * two iovecs (e.g., for writev(2)); release them afterwards with
+ * ringbufPoolAdvanceTail. Returns the number of iovecs filled.
+ */
+int ringbufPoolUsedIov(const struct ringbuf_pool_s *pool, uint32_t ring,
+                       struct iovec iov[2]);
+
+/*
+ * Release count used bytes from the front of ring buffer ring.
+ */
+void ringbufPoolAdvanceTail(ringbuf_pool_t pool, uint32_t ring, size_t count);
+
+/*
+ * Store the indices of up to max non-empty ring buffers, starting the
+ * scan at index start, in rings. Returns the number stored; if it is
+ * max, continue the scan from one past the last index stored.
+ */
+size_t ringbufPoolNonEmpty(const struct ringbuf_pool_s *pool, uint32_t start,
+                           uint32_t *rings, size_t max);
+
 //additions taken from fork of zipper97412/c-ringbuf
 
 /*poke some data from buffer src into ringbuffer*/
@@ -326,4 +1171,8 @@ int ringbufDMAForbiddenInRange(ringbuf_t rb, uint8_t *memBot, uint8_t *memTop);
 
 
 
+#ifdef __cplusplus
+}
+#endif
+
 #endif /* INCLUDED_RINGBUF_H */
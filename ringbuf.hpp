@@ -0,0 +1,386 @@
+#ifndef INCLUDED_RINGBUF_HPP
+#define INCLUDED_RINGBUF_HPP
+
+/*
+ * ringbuf.hpp - C++ interface to the C ring buffer.
+ *
+ * To the extent possible under law, the author(s) have dedicated all
+ * copyright and related and neighboring rights to this software to
+ * the public domain worldwide. This software is distributed without
+ * any warranty.
+ *
+ * You should have received a copy of the CC0 Public Domain Dedication
+ * along with this software. If not, see
+ * <http://creativecommons.org/publicdomain/zero/1.0/>.
+ */
+
+/*
+ * A thin, header-only C++20 wrapper around ringbuf_t. The ringbuf
+ * class owns its ring buffer (and frees it with ringbufFree), is
+ * move-only, and exposes the ring buffer's contents as std::spans, so
+ * C++ code can read and write in place instead of staging data in
+ * temporary containers. Nothing is allocated after construction.
+ *
+ * Unlike ringbufMemcpyInto, write() never overflows the ring buffer.
+ */
+
+#include <algorithm>
+#include <array>
+#include <compare>
+#include <cstddef>
+#include <cstring>
+#include <iterator>
+#include <memory_resource>
+#include <new>
+#include <span>
+#include <type_traits>
+#include <utility>
+
+#include "ringbuf.h"
+
+namespace cringbuf {
+
+/*
+ * A random-access iterator over a ring buffer's used bytes, in FIFO
+ * order, that hides the wrap. It is positioned by logical offset from
+ * the tail pointer, and maps offsets to addresses using the tail
+ * pointer and ringbufEnd. Like a pointer into the ring buffer, it is
+ * invalidated when the ring buffer's tail pointer moves.
+ *
+ * Stepping through the bytes one at a time costs a compare per byte;
+ * algorithms that can work on contiguous memory should use
+ * ringbuf::for_each_segment instead.
+ */
+class byte_iterator
+{
+public:
+    using iterator_concept = std::random_access_iterator_tag;
+    using iterator_category = std::random_access_iterator_tag;
+    using value_type = std::byte;
+    using difference_type = std::ptrdiff_t;
+    using pointer = const std::byte *;
+    using reference = const std::byte &;
+
+    byte_iterator() = default;
+
+    byte_iterator(const std::byte *tail, const std::byte *end,
+                  std::size_t bufsize, difference_type off) noexcept
+        : tail_(tail), wrap_(end - tail), bufsize_(bufsize), off_(off)
+    {
+    }
+
+    reference operator*() const noexcept { return (*this)[0]; }
+    pointer operator->() const noexcept { return &**this; }
+
+    reference operator[](difference_type n) const noexcept
+    {
+        difference_type i = off_ + n;
+        return tail_[i < wrap_ ? i : i - static_cast<difference_type>(bufsize_)];
+    }
+
+    byte_iterator &operator++() noexcept { ++off_; return *this; }
+    byte_iterator &operator--() noexcept { --off_; return *this; }
+    byte_iterator operator++(int) noexcept { byte_iterator t = *this; ++off_; return t; }
+    byte_iterator operator--(int) noexcept { byte_iterator t = *this; --off_; return t; }
+    byte_iterator &operator+=(difference_type n) noexcept { off_ += n; return *this; }
+    byte_iterator &operator-=(difference_type n) noexcept { off_ -= n; return *this; }
+
+    friend byte_iterator operator+(byte_iterator it, difference_type n) noexcept
+    {
+        return it += n;
+    }
+    friend byte_iterator operator+(difference_type n, byte_iterator it) noexcept
+    {
+        return it += n;
+    }
+    friend byte_iterator operator-(byte_iterator it, difference_type n) noexcept
+    {
+        return it -= n;
+    }
+    friend difference_type operator-(const byte_iterator &a,
+                                     const byte_iterator &b) noexcept
+    {
+        return a.off_ - b.off_;
+    }
+    friend bool operator==(const byte_iterator &a, const byte_iterator &b) noexcept
+    {
+        return a.off_ == b.off_;
+    }
+    friend std::strong_ordering operator<=>(const byte_iterator &a,
+                                            const byte_iterator &b) noexcept
+    {
+        return a.off_ <=> b.off_;
+    }
+
+    /*
+     * The iterator's logical offset from the tail pointer, e.g. to
+     * pass to ringbufFindchr or ringbufPeekRange.
+     */
+    difference_type offset() const noexcept { return off_; }
+
+private:
+    const std::byte *tail_ = nullptr;
+    difference_type wrap_ = 0;
+    std::size_t bufsize_ = 0;
+    difference_type off_ = 0;
+};
+
+class ringbuf
+{
+public:
+    /*
+     * Create a ring buffer with the given usable capacity. Throws
+     * std::bad_alloc if there isn't enough memory.
+     */
+    explicit ringbuf(std::size_t capacity)
+        : rb_(ringbufNew(capacity))
+    {
+        if (!rb_)
+            throw std::bad_alloc();
+    }
+
+    /*
+     * Take ownership of an existing ring buffer, which must have been
+     * created with ringbufNew.
+     */
+    explicit ringbuf(ringbuf_t rb) noexcept
+        : rb_(rb)
+    {
+    }
+
+    ~ringbuf()
+    {
+        if (rb_)
+            ringbufFree(&rb_);
+    }
+
+    ringbuf(const ringbuf &) = delete;
+    ringbuf &operator=(const ringbuf &) = delete;
+
+    /*
+     * A moved-from ringbuf owns nothing; it may only be destroyed or
+     * assigned to.
+     */
+    ringbuf(ringbuf &&other) noexcept
+        : rb_(std::exchange(other.rb_, nullptr))
+    {
+    }
+
+    ringbuf &operator=(ringbuf &&other) noexcept
+    {
+        if (this != &other) {
+            if (rb_)
+                ringbufFree(&rb_);
+            rb_ = std::exchange(other.rb_, nullptr);
+        }
+        return *this;
+    }
+
+    /*
+     * The underlying C ring buffer, for use with the C interface.
+     */
+    ringbuf_t get() const noexcept { return rb_; }
+
+    /*
+     * Give up ownership of the underlying C ring buffer; the caller
+     * becomes responsible for freeing it.
+     */
+    ringbuf_t release() noexcept { return std::exchange(rb_, nullptr); }
+
+    std::size_t capacity() const noexcept { return ringbufCapacity(rb_); }
+    std::size_t size() const noexcept { return ringbufBytesUsed(rb_); }
+    std::size_t available() const noexcept { return ringbufBytesFree(rb_); }
+    bool empty() const noexcept { return ringbufIsEmpty(rb_); }
+    bool full() const noexcept { return ringbufIsFull(rb_); }
+    void clear() noexcept { ringbufReset(rb_); }
+
+    /*
+     * Append as much of src as fits. Returns the number of bytes
+     * written.
+     */
+    std::size_t write(std::span<const std::byte> src) noexcept
+    {
+        std::size_t n = 0;
+        for (std::span<std::byte> seg : writable_segments()) {
+            std::size_t m = std::min(seg.size(), src.size() - n);
+            if (m)
+                std::memcpy(seg.data(), src.data() + n, m);
+            n += m;
+        }
+        commit(n);
+        return n;
+    }
+
+    /*
+     * Remove up to dst.size() bytes from the front of the ring buffer
+     * into dst. Returns the number of bytes read: none while any bytes
+     * are in flight (see ringbufBytesInflight).
+     */
+    std::size_t read(std::span<std::byte> dst) noexcept
+    {
+        if (ringbufBytesInflight(rb_))
+            return 0;
+        std::size_t n = 0;
+        for (std::span<const std::byte> seg : readable_segments()) {
+            std::size_t m = std::min(seg.size(), dst.size() - n);
+            if (m)
+                std::memcpy(dst.data() + n, seg.data(), m);
+            n += m;
+        }
+        consume(n);
+        return n;
+    }
+
+    /*
+     * The used bytes, in FIFO order, as two spans; the second one is
+     * empty unless the data wraps. Valid until the ring buffer is
+     * next modified.
+     */
+    std::array<std::span<const std::byte>, 2> readable_segments() const noexcept
+    {
+        struct iovec iov[2];
+        int niov = ringbufUsedIov(rb_, size(), iov);
+        return {as_span<const std::byte>(iov[0], niov > 0),
+                as_span<const std::byte>(iov[1], niov > 1)};
+    }
+
+    /*
+     * Iterators over the used bytes, so standard algorithms can run
+     * on the ring buffer's contents without linearizing them first.
+     */
+    byte_iterator begin() const noexcept { return iter(0); }
+    byte_iterator end() const noexcept
+    {
+        return iter(static_cast<std::ptrdiff_t>(size()));
+    }
+
+    /*
+     * Call f with each non-empty contiguous segment of used bytes (a
+     * std::span<const std::byte>), in FIFO order, so that inner loops
+     * run over plain memory. If f returns bool, returning false stops
+     * the iteration early. Returns false if f stopped it.
+     */
+    template <typename F>
+    bool for_each_segment(F &&f) const
+    {
+        for (std::span<const std::byte> seg : readable_segments()) {
+            if (seg.empty())
+                continue;
+            if constexpr (std::is_same_v<std::invoke_result_t<F &,
+                              std::span<const std::byte>>, bool>) {
+                if (!f(seg))
+                    return false;
+            } else
+                f(seg);
+        }
+        return true;
+    }
+
+    /*
+     * The free bytes following the head, as two spans. Write into
+     * them, then call commit() with the number of bytes written.
+     */
+    std::array<std::span<std::byte>, 2> writable_segments() noexcept
+    {
+        struct iovec iov[2];
+        int niov = ringbufFreeIov(rb_, available(), iov);
+        return {as_span<std::byte>(iov[0], niov > 0),
+                as_span<std::byte>(iov[1], niov > 1)};
+    }
+
+    /*
+     * Publish n bytes written into writable_segments().
+     */
+    void commit(std::size_t n) noexcept { ringbufAdvanceHead(rb_, n); }
+
+    /*
+     * Release n bytes from the front of the ring buffer. n must not
+     * exceed size(), and no bytes may be in flight.
+     */
+    void consume(std::size_t n) noexcept { ringbufAdvanceTail(rb_, n); }
+
+private:
+    byte_iterator iter(std::ptrdiff_t off) const noexcept
+    {
+        return {static_cast<const std::byte *>(ringbufTail(rb_)),
+                reinterpret_cast<const std::byte *>(ringbufEnd(rb_)),
+                ringbufBufferSize(rb_), off};
+    }
+
+    template <typename T>
+    static std::span<T> as_span(const struct iovec &iov, bool valid) noexcept
+    {
+        if (!valid)
+            return {};
+        return {static_cast<T *>(iov.iov_base), iov.iov_len};
+    }
+
+    ringbuf_t rb_;
+};
+
+/*
+ * A std::pmr::memory_resource that allocates from a FIFO arena (see
+ * ringbufArenaNew), for containers and objects whose memory is
+ * mostly released in the order it was allocated, e.g., per-message
+ * buffers. Memory released out of order is only reclaimed once
+ * everything allocated before it has been released, too.
+ *
+ * Allocation throws std::bad_alloc when the arena is full. Like the
+ * arena, the resource is not thread-safe.
+ */
+class arena_resource : public std::pmr::memory_resource
+{
+public:
+    /*
+     * Create an arena of capacity bytes, for up to maxlive objects at
+     * once. Throws std::bad_alloc if there isn't enough memory.
+     */
+    explicit arena_resource(std::size_t capacity, std::size_t maxlive = 64)
+        : arena_(ringbufArenaNew(capacity, maxlive))
+    {
+        if (!arena_)
+            throw std::bad_alloc();
+    }
+
+    ~arena_resource() override { ringbufArenaFree(&arena_); }
+
+    arena_resource(const arena_resource &) = delete;
+    arena_resource &operator=(const arena_resource &) = delete;
+
+    /*
+     * The underlying C arena, for use with the C interface.
+     */
+    ringbuf_arena_t get() const noexcept { return arena_; }
+
+    std::size_t live() const noexcept { return ringbufArenaLive(arena_); }
+    std::size_t bytes_used() const noexcept
+    {
+        return ringbufArenaBytesUsed(arena_);
+    }
+
+private:
+    void *do_allocate(std::size_t bytes, std::size_t alignment) override
+    {
+        void *p = ringbufArenaAlloc(arena_, bytes, alignment);
+        if (!p)
+            throw std::bad_alloc();
+        return p;
+    }
+
+    void do_deallocate(void *p, std::size_t, std::size_t) override
+    {
+        ringbufArenaRelease(arena_, p);
+    }
+
+    bool do_is_equal(const std::pmr::memory_resource &other)
+        const noexcept override
+    {
+        return this == &other;
+    }
+
+    ringbuf_arena_t arena_;
+};
+
+} // namespace cringbuf
+
+#endif /* INCLUDED_RINGBUF_HPP */